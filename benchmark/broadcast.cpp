@@ -0,0 +1,189 @@
+//
+//  cppsocket
+//
+
+#include <iostream>
+#include <iomanip>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include "Socket.hpp"
+#include "BroadcastHub.hpp"
+
+// Publishes the same messages to all subscribers either through the broadcast hub,
+// which queues one shared buffer on every subscriber, or by sending a copy to every subscriber
+static void printUsage(const std::string& executable)
+{
+    std::cout << "Usage: " << executable << " [--mode hub|send|both] [--port port] [--subscribers count,...]" << std::endl <<
+        "    [--messages count] [--size bytes] [--batch messages]" << std::endl;
+}
+
+static void run(bool useHub, uint16_t port, size_t subscribers, size_t messages, size_t size, size_t batch)
+{
+    cppsocket::Network serverNetwork;
+    cppsocket::Socket server(serverNetwork);
+    std::vector<cppsocket::SocketHandle> accepted;
+
+    // the messages are never dropped, so every subscriber gets all of them
+    cppsocket::BroadcastHub hub(serverNetwork, cppsocket::SlowConsumerPolicy::Drop, 0);
+
+    server.setBlocking(false);
+    server.setAcceptQueueSize(static_cast<int>(subscribers));
+    server.startAccept(cppsocket::ANY_ADDRESS, port);
+    server.setAcceptCallback([&accepted, &hub](cppsocket::Socket&, cppsocket::Socket& c) {
+        accepted.push_back(c.getHandle());
+        hub.subscribe("updates", c);
+    });
+
+    std::atomic<uint64_t> received(0);
+    std::atomic<bool> running(true);
+    std::atomic<bool> failed(false);
+
+    std::thread clientThread([&]() {
+        cppsocket::Network clientNetwork;
+        std::vector<std::unique_ptr<cppsocket::Socket>> clients;
+
+        for (size_t i = 0; i < subscribers; ++i)
+        {
+            clients.push_back(std::unique_ptr<cppsocket::Socket>(new cppsocket::Socket(clientNetwork)));
+            clients.back()->setBlocking(false);
+            clients.back()->setReadCallback([&received](cppsocket::Socket&, const std::vector<uint8_t>& data) {
+                received.fetch_add(data.size(), std::memory_order_relaxed);
+            });
+            clients.back()->setConnectErrorCallback([&failed](cppsocket::Socket&) {
+                failed = true;
+            });
+            clients.back()->connect(cppsocket::ipToString(htonl(INADDR_LOOPBACK)) + ":" + std::to_string(port));
+        }
+
+        while (running)
+            clientNetwork.update(0.01f);
+    });
+
+    while (accepted.size() < subscribers && !failed)
+        serverNetwork.update(0.01f);
+
+    const std::vector<uint8_t> message(size, 'm');
+    const uint64_t total = static_cast<uint64_t>(messages) * subscribers * size;
+    size_t published = 0;
+    // time spent queuing the messages, without the writes to the sockets
+    std::chrono::steady_clock::duration publishTime(0);
+
+    const auto startTime = std::chrono::steady_clock::now();
+
+    while (received.load(std::memory_order_relaxed) < total && !failed)
+    {
+        const auto publishStart = std::chrono::steady_clock::now();
+
+        for (size_t i = 0; i < batch && published < messages; ++i, ++published)
+        {
+            if (useHub)
+                hub.publish("updates", message);
+            else
+                for (cppsocket::SocketHandle handle : accepted)
+                    if (cppsocket::Socket* socket = serverNetwork.getSocket(handle))
+                        socket->send(message);
+        }
+
+        publishTime += std::chrono::steady_clock::now() - publishStart;
+
+        serverNetwork.update(0.0f);
+    }
+
+    const float elapsed = std::chrono::duration<float>(std::chrono::steady_clock::now() - startTime).count();
+
+    running = false;
+    clientThread.join();
+
+    if (failed)
+        throw std::runtime_error("Failed to connect to the server");
+
+    std::cout << std::fixed << std::setprecision(0) << (useHub ? "hub " : "send") <<
+        " subscribers: " << std::setw(6) << subscribers << ", " <<
+        std::setw(10) << static_cast<double>(messages) * subscribers / elapsed << " deliveries/s, " <<
+        std::setw(6) << total / elapsed / (1024.0 * 1024.0) << " MiB/s, " <<
+        std::setprecision(1) << elapsed * 1000000000.0 / (static_cast<double>(messages) * subscribers) << " ns per delivery, " <<
+        std::chrono::duration<double, std::nano>(publishTime).count() / (static_cast<double>(messages) * subscribers) << " ns to queue" << std::endl;
+}
+
+int main(int argc, const char* argv[])
+{
+    try
+    {
+        std::string mode = "both";
+        uint16_t port = 9000;
+        std::vector<size_t> subscriberCounts = {10, 100, 1000};
+        size_t messages = 2000;
+        size_t size = 256;
+        size_t batch = 16;
+
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string argument = argv[i];
+
+            if (i + 1 >= argc)
+            {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+
+            std::string value = argv[++i];
+
+            if (argument == "--mode") mode = value;
+            else if (argument == "--port") port = static_cast<uint16_t>(std::stoul(value));
+            else if (argument == "--subscribers")
+            {
+                subscriberCounts.clear();
+                std::stringstream stream(value);
+                std::string count;
+                while (std::getline(stream, count, ','))
+                    subscriberCounts.push_back(std::stoul(count));
+            }
+            else if (argument == "--messages") messages = std::stoul(value);
+            else if (argument == "--size") size = std::stoul(value);
+            else if (argument == "--batch") batch = std::stoul(value);
+            else
+            {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+
+        if ((mode != "hub" && mode != "send" && mode != "both") ||
+            subscriberCounts.empty() || messages == 0 || size == 0 || batch == 0)
+        {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        for (size_t subscribers : subscriberCounts)
+        {
+            if (subscribers == 0)
+            {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+
+            if (mode != "send")
+                run(true, port, subscribers, messages, size, batch);
+
+            if (mode != "hub")
+                run(false, port, subscribers, messages, size, batch);
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    catch (...)
+    {
+        std::cerr << "Error" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,194 @@
+//
+//  cppsocket
+//
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#ifndef _WIN32
+#  include <sys/resource.h>
+#endif
+#include "Socket.hpp"
+
+// All clients reset their connections at once (they are closed with unread data, which makes the
+// kernel send a reset) and the server updates until it has closed all the connections.
+// Every reset is either thrown out of the update or given to the error callback of the socket
+static void printUsage(const std::string& executable)
+{
+    std::cout << "Usage: " << executable << " [--mode throw|callback|both] [--port port] [--connections count] [--rounds count]" << std::endl;
+}
+
+static void raiseFileLimit()
+{
+#ifndef _WIN32
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+#endif
+}
+
+static void run(bool useCallback, uint16_t port, size_t connections, size_t rounds)
+{
+    cppsocket::Network serverNetwork;
+    cppsocket::Network clientNetwork;
+    cppsocket::Socket server(serverNetwork);
+    std::vector<cppsocket::SocketHandle> accepted;
+    size_t closed = 0;
+    uint64_t errors = 0;
+
+    server.setBlocking(false);
+    server.setAcceptQueueSize(static_cast<int>(connections));
+    server.startAccept(cppsocket::ANY_ADDRESS, port);
+    server.setAcceptCallback([&accepted, &closed](cppsocket::Socket&, cppsocket::Socket& c) {
+        accepted.push_back(c.getHandle());
+        c.startRead();
+        c.setCloseCallback([&closed](cppsocket::Socket&) {
+            ++closed;
+        });
+    });
+
+    // inherited by the accepted sockets
+    if (useCallback)
+        server.setErrorCallback([&errors](cppsocket::Socket&, const std::error_code&) {
+            ++errors;
+        });
+
+    const std::vector<uint8_t> message(1, 'x');
+    uint64_t totalUpdates = 0;
+    std::chrono::steady_clock::duration totalTime(0);
+
+    for (size_t round = 0; round < rounds; ++round)
+    {
+        std::vector<std::unique_ptr<cppsocket::Socket>> clients;
+        size_t connected = 0;
+        bool failed = false;
+
+        accepted.clear();
+        closed = 0;
+
+        for (size_t i = 0; i < connections; ++i)
+        {
+            clients.push_back(std::unique_ptr<cppsocket::Socket>(new cppsocket::Socket(clientNetwork)));
+            clients.back()->setBlocking(false);
+            clients.back()->setConnectCallback([&connected](cppsocket::Socket&) {
+                ++connected;
+            });
+            clients.back()->setConnectErrorCallback([&failed](cppsocket::Socket&) {
+                failed = true;
+            });
+            clients.back()->connect(cppsocket::ipToString(htonl(INADDR_LOOPBACK)) + ":" + std::to_string(port));
+        }
+
+        while ((accepted.size() < connections || connected < connections) && !failed)
+        {
+            clientNetwork.update(0.0f);
+            serverNetwork.update(0.0f);
+        }
+
+        if (failed)
+            throw std::runtime_error("Failed to connect to the server");
+
+        // the clients do not read the data, so closing them resets the connections
+        for (cppsocket::SocketHandle handle : accepted)
+            if (cppsocket::Socket* socket = serverNetwork.getSocket(handle))
+                socket->send(message);
+
+        serverNetwork.update(0.0f);
+        clients.clear();
+
+        uint64_t updates = 0;
+        const auto startTime = std::chrono::steady_clock::now();
+
+        while (closed < connections)
+        {
+            try
+            {
+                serverNetwork.update(0.0f);
+            }
+            catch (const std::system_error&)
+            {
+                ++errors;
+            }
+
+            ++updates;
+        }
+
+        totalTime += std::chrono::steady_clock::now() - startTime;
+        totalUpdates += updates;
+    }
+
+    const double disconnects = static_cast<double>(connections) * rounds;
+
+    std::cout << std::fixed << std::setprecision(1) << (useCallback ? "callback" : "throw   ") <<
+        " connections: " << connections << ", " <<
+        std::setw(8) << static_cast<double>(totalUpdates) / rounds << " updates per storm, " <<
+        std::setw(8) << std::chrono::duration<double, std::milli>(totalTime).count() / rounds << " ms per storm, " <<
+        std::setw(8) << std::chrono::duration<double, std::nano>(totalTime).count() / disconnects << " ns per disconnect, " <<
+        std::setprecision(0) << errors / disconnects * 100.0 << "% reported as errors" << std::endl;
+}
+
+int main(int argc, const char* argv[])
+{
+    try
+    {
+        std::string mode = "both";
+        uint16_t port = 9000;
+        size_t connections = 1000;
+        size_t rounds = 5;
+
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string argument = argv[i];
+
+            if (i + 1 >= argc)
+            {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+
+            std::string value = argv[++i];
+
+            if (argument == "--mode") mode = value;
+            else if (argument == "--port") port = static_cast<uint16_t>(std::stoul(value));
+            else if (argument == "--connections") connections = std::stoul(value);
+            else if (argument == "--rounds") rounds = std::stoul(value);
+            else
+            {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+
+        if ((mode != "throw" && mode != "callback" && mode != "both") ||
+            connections == 0 || rounds == 0)
+        {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        raiseFileLimit();
+
+        if (mode != "callback")
+            run(false, port, connections, rounds);
+
+        if (mode != "throw")
+            run(true, port, connections, rounds);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    catch (...)
+    {
+        std::cerr << "Error" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
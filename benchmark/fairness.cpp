@@ -0,0 +1,192 @@
+//
+//  cppsocket
+//
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include "Socket.hpp"
+#include "Histogram.hpp"
+
+// The server streams data to the bulk connections as fast as they can take it and echoes the
+// messages of the interactive connection, which measures the round-trip time of the echo
+static void printUsage(const std::string& executable)
+{
+    std::cout << "Usage: " << executable << " [--port port] [--bulk connections] [--chunk KiB] [--messages count]" << std::endl <<
+        "    [--quantum bytes] [--budget bytes] [--priority 0|1]" << std::endl;
+}
+
+int main(int argc, const char* argv[])
+{
+    try
+    {
+        uint16_t port = 9000;
+        size_t bulkConnections = 8;
+        size_t chunkSize = 1024 * 1024;
+        size_t messages = 20000;
+        size_t warmup = 1000;
+        size_t quantum = 0;
+        size_t budget = 0;
+        bool priority = false;
+
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string argument = argv[i];
+
+            if (i + 1 >= argc)
+            {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+
+            unsigned long value = std::stoul(argv[++i]);
+
+            if (argument == "--port") port = static_cast<uint16_t>(value);
+            else if (argument == "--bulk") bulkConnections = value;
+            else if (argument == "--chunk") chunkSize = value * 1024;
+            else if (argument == "--messages") messages = value;
+            else if (argument == "--quantum") quantum = value;
+            else if (argument == "--budget") budget = value;
+            else if (argument == "--priority") priority = (value != 0);
+            else
+            {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+
+        if (messages == 0 || chunkSize == 0)
+        {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        cppsocket::Network serverNetwork;
+        serverNetwork.setWriteQuantum(quantum);
+        serverNetwork.setWriteBudget(budget);
+
+        cppsocket::Socket bulkServer(serverNetwork);
+        cppsocket::Socket interactiveServer(serverNetwork);
+        std::vector<cppsocket::SocketHandle> bulkSockets;
+        const std::vector<uint8_t> chunk(chunkSize, 'b');
+        bool running = true;
+
+        bulkServer.setBlocking(false);
+        bulkServer.startAccept(cppsocket::ANY_ADDRESS, port);
+        bulkServer.setAcceptCallback([&bulkSockets](cppsocket::Socket&, cppsocket::Socket& c) {
+            bulkSockets.push_back(c.getHandle());
+        });
+
+        interactiveServer.setBlocking(false);
+        interactiveServer.startAccept(cppsocket::ANY_ADDRESS, static_cast<uint16_t>(port + 1));
+        interactiveServer.setAcceptCallback([priority](cppsocket::Socket&, cppsocket::Socket& c) {
+            if (priority) c.setWritePriority(1);
+            c.startRead();
+            c.setReadCallback([](cppsocket::Socket& socket, const std::vector<uint8_t>& data) {
+                socket.send(data);
+            });
+        });
+
+        std::thread serverThread([&]() {
+            while (running)
+            {
+                // keep the bulk connections backlogged
+                for (cppsocket::SocketHandle handle : bulkSockets)
+                    if (cppsocket::Socket* socket = serverNetwork.getSocket(handle))
+                        if (socket->isReady() && socket->getOutDataSize() < chunk.size())
+                            socket->send(chunk);
+
+                serverNetwork.update(-1.0f);
+            }
+        });
+
+        cppsocket::Network clientNetwork;
+        std::vector<std::unique_ptr<cppsocket::Socket>> bulkClients;
+        uint64_t bulkReceived = 0;
+
+        for (size_t i = 0; i < bulkConnections; ++i)
+        {
+            bulkClients.push_back(std::unique_ptr<cppsocket::Socket>(new cppsocket::Socket(clientNetwork)));
+            bulkClients.back()->setBlocking(false);
+            bulkClients.back()->setReadCallback([&bulkReceived](cppsocket::Socket&, const std::vector<uint8_t>& data) {
+                bulkReceived += data.size();
+            });
+            bulkClients.back()->connect(cppsocket::ipToString(htonl(INADDR_LOOPBACK)) + ":" + std::to_string(port));
+        }
+
+        cppsocket::Socket client(clientNetwork);
+        const std::vector<uint8_t> message(64, 'i');
+        cppsocket::Histogram histogram;
+        size_t received = 0;
+        size_t sent = 0;
+        bool done = false;
+        bool failed = false;
+        std::chrono::steady_clock::time_point sendTime;
+
+        auto sendMessage = [&](cppsocket::Socket& socket) {
+            sendTime = std::chrono::steady_clock::now();
+            socket.send(message);
+            ++sent;
+        };
+
+        client.setBlocking(false);
+        client.setConnectCallback(sendMessage);
+        client.setConnectErrorCallback([&done, &failed](cppsocket::Socket&) {
+            done = failed = true;
+        });
+        client.setReadCallback([&](cppsocket::Socket& socket, const std::vector<uint8_t>& data) {
+            received += data.size();
+
+            if (received >= message.size())
+            {
+                received -= message.size();
+
+                if (sent > warmup)
+                    histogram.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - sendTime).count()));
+
+                if (sent < warmup + messages)
+                    sendMessage(socket);
+                else
+                    done = true;
+            }
+        });
+        client.connect(cppsocket::ipToString(htonl(INADDR_LOOPBACK)) + ":" + std::to_string(port + 1));
+
+        const auto startTime = std::chrono::steady_clock::now();
+
+        while (!done)
+            clientNetwork.update(-1.0f);
+
+        const float elapsed = std::chrono::duration<float>(std::chrono::steady_clock::now() - startTime).count();
+
+        serverNetwork.post([&running]() { running = false; });
+        serverThread.join();
+
+        if (failed)
+            throw std::runtime_error("Failed to connect to the server");
+
+        std::cout << "Quantum: " << quantum << ", budget: " << budget << ", priority: " << (priority ? "on" : "off") <<
+            ", bulk connections: " << bulkConnections << std::endl;
+        std::cout << std::fixed << std::setprecision(1) <<
+            "Interactive round trip p50 " << histogram.getValueAtPercentile(50.0) / 1000.0 <<
+            ", p99 " << histogram.getValueAtPercentile(99.0) / 1000.0 <<
+            ", p99.9 " << histogram.getValueAtPercentile(99.9) / 1000.0 <<
+            ", max " << histogram.getMax() / 1000.0 << " us" << std::endl <<
+            "Bulk throughput " << bulkReceived / elapsed / (1024.0 * 1024.0) << " MiB/s" << std::endl;
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    catch (...)
+    {
+        std::cerr << "Error" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
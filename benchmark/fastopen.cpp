@@ -0,0 +1,193 @@
+//
+//  cppsocket
+//
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include "Socket.hpp"
+#include "Histogram.hpp"
+
+// The handshake costs a round trip only on a link with latency, to add delay to the loopback interface on Linux:
+//     tc qdisc add dev lo root netem delay 5ms
+// and to remove it:
+//     tc qdisc del dev lo root
+// Fast Open has to be enabled for both the client and the server with:
+//     sysctl -w net.ipv4.tcp_fastopen=3
+
+static void printUsage(const std::string& executable)
+{
+    std::cout << "Usage: " << executable << " [--port port] [--connections count] [--size bytes] [--fast-open 0|1|2 (both)]" << std::endl;
+}
+
+// returns the value of a counter from /proc/net/netstat or 0 if it is not available
+static uint64_t getNetstatCounter(const std::string& name)
+{
+#ifdef __linux__
+    std::ifstream file("/proc/net/netstat");
+    std::string names;
+    std::string values;
+
+    while (std::getline(file, names) && std::getline(file, values))
+    {
+        std::istringstream nameStream(names);
+        std::istringstream valueStream(values);
+        std::string counterName;
+        std::string value;
+
+        while (nameStream >> counterName && valueStream >> value)
+            if (counterName == name)
+                return std::stoull(value);
+    }
+#else
+    (void)name;
+#endif
+
+    return 0;
+}
+
+static void run(uint16_t port, size_t connections, size_t size, bool fastOpen)
+{
+    cppsocket::Network network;
+    cppsocket::Socket client(network);
+    std::vector<uint8_t> message(size, 'x');
+    cppsocket::Histogram histogram;
+    size_t received = 0;
+    bool done = false;
+    bool failed = false;
+    std::chrono::steady_clock::time_point startTime;
+
+    client.setBlocking(false);
+    client.setFastOpen(fastOpen);
+    client.setConnectErrorCallback([&done, &failed](cppsocket::Socket&) {
+        done = failed = true;
+    });
+    client.setReadCallback([&](cppsocket::Socket& socket, const std::vector<uint8_t>& data) {
+        received += data.size();
+
+        if (received >= size)
+        {
+            histogram.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count()));
+            socket.close();
+            done = true;
+        }
+    });
+
+    const uint64_t activeBefore = getNetstatCounter("TCPFastOpenActive");
+
+    for (size_t i = 0; i < connections && !failed; ++i)
+    {
+        received = 0;
+        done = false;
+        startTime = std::chrono::steady_clock::now();
+        client.connect(cppsocket::ipToString(htonl(INADDR_LOOPBACK)) + ":" + std::to_string(port));
+        // sent in the SYN if the server has given a cookie before
+        client.send(message);
+
+        while (!done)
+            network.update(-1.0f);
+    }
+
+    if (failed)
+        throw std::runtime_error("Failed to connect to the server");
+
+    std::cout << (fastOpen ? "Fast Open" : "Handshake") << ": " << histogram.getCount() << " connections" <<
+        std::fixed << std::setprecision(1) <<
+        ", p50 " << histogram.getValueAtPercentile(50.0) / 1000.0 <<
+        ", p99 " << histogram.getValueAtPercentile(99.0) / 1000.0 <<
+        ", max " << histogram.getMax() / 1000.0 << " us" << std::endl;
+
+    if (fastOpen)
+        std::cout << "Connections with data in the SYN: " << getNetstatCounter("TCPFastOpenActive") - activeBefore << std::endl;
+}
+
+int main(int argc, const char* argv[])
+{
+    try
+    {
+        uint16_t port = 9000;
+        size_t connections = 1000;
+        size_t size = 64;
+        unsigned long fastOpen = 2;
+
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string argument = argv[i];
+
+            if (i + 1 >= argc)
+            {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+
+            unsigned long value = std::stoul(argv[++i]);
+
+            if (argument == "--port") port = static_cast<uint16_t>(value);
+            else if (argument == "--connections") connections = value;
+            else if (argument == "--size") size = value;
+            else if (argument == "--fast-open") fastOpen = value;
+            else
+            {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+
+        if (connections == 0 || size == 0 || fastOpen > 2)
+        {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        cppsocket::Network serverNetwork;
+        cppsocket::Socket server(serverNetwork);
+        bool running = true;
+
+        server.setBlocking(false);
+        server.setFastOpenQueueSize(static_cast<int>(connections));
+        server.setAcceptQueueSize(128);
+        server.startAccept(cppsocket::ANY_ADDRESS, port);
+        server.setAcceptCallback([](cppsocket::Socket&, cppsocket::Socket& c) {
+            c.startRead();
+            c.setReadCallback([](cppsocket::Socket& socket, const std::vector<uint8_t>& data) {
+                socket.send(data);
+            });
+        });
+
+        std::thread serverThread([&serverNetwork, &running]() {
+            while (running)
+                serverNetwork.update(-1.0f);
+        });
+
+        try
+        {
+            if (fastOpen != 1) run(port, connections, size, false);
+            if (fastOpen != 0) run(port, connections, size, true);
+        }
+        catch (...)
+        {
+            serverNetwork.post([&running]() { running = false; });
+            serverThread.join();
+            throw;
+        }
+
+        serverNetwork.post([&running]() { running = false; });
+        serverThread.join();
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    catch (...)
+    {
+        std::cerr << "Error" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,212 @@
+//
+//  cppsocket
+//
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+#include "Socket.hpp"
+#include "Histogram.hpp"
+
+static void printUsage(const std::string& executable)
+{
+    std::cout << "Usage: " << executable << " [--port port] [--messages count] [--warmup count] [--size bytes]" << std::endl <<
+        "    [--spin microseconds] [--busy-poll microseconds] [--client-cpu cpu] [--server-cpu cpu] [--timestamping 0|1]" << std::endl;
+}
+
+static void printDelay(const std::string& title, const cppsocket::Histogram& histogram)
+{
+    std::cout << std::fixed << std::setprecision(1) << "    " << std::left << std::setw(18) << title << std::right <<
+        " p50 " << histogram.getValueAtPercentile(50.0) / 1000.0 <<
+        ", p99 " << histogram.getValueAtPercentile(99.0) / 1000.0 <<
+        ", max " << histogram.getMax() / 1000.0 << " us" << std::endl;
+}
+
+static void printLatencyStats(const std::string& title, const cppsocket::LatencyStats& stats)
+{
+    std::cout << title << " kernel timestamps:" << std::endl;
+    printDelay("receive wait", stats.receiveWaitDelay);
+    printDelay("receive dispatch", stats.receiveDispatchDelay);
+    printDelay("send queue", stats.sendQueueDelay);
+    printDelay("send kernel", stats.sendKernelDelay);
+}
+
+static double percentile(const std::vector<int64_t>& sortedSamples, double fraction)
+{
+    size_t index = static_cast<size_t>(fraction * sortedSamples.size());
+    if (index >= sortedSamples.size()) index = sortedSamples.size() - 1;
+    return sortedSamples[index] / 1000.0;
+}
+
+int main(int argc, const char* argv[])
+{
+    try
+    {
+        uint16_t port = 9000;
+        size_t messages = 100000;
+        size_t warmup = 1000;
+        size_t size = 64;
+        uint32_t spin = 0;
+        uint32_t busyPoll = 0;
+        int clientCpu = -1;
+        int serverCpu = -1;
+        bool timestamping = false;
+
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string argument = argv[i];
+
+            if (i + 1 >= argc)
+            {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+
+            unsigned long value = std::stoul(argv[++i]);
+
+            if (argument == "--port") port = static_cast<uint16_t>(value);
+            else if (argument == "--messages") messages = value;
+            else if (argument == "--warmup") warmup = value;
+            else if (argument == "--size") size = value;
+            else if (argument == "--spin") spin = static_cast<uint32_t>(value);
+            else if (argument == "--busy-poll") busyPoll = static_cast<uint32_t>(value);
+            else if (argument == "--client-cpu") clientCpu = static_cast<int>(value);
+            else if (argument == "--server-cpu") serverCpu = static_cast<int>(value);
+            else if (argument == "--timestamping") timestamping = (value != 0);
+            else
+            {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+
+        if (messages == 0 || size == 0)
+        {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        cppsocket::Network serverNetwork;
+        serverNetwork.setSpinTime(spin / 1000000.0f);
+        serverNetwork.setBusyPollTime(busyPoll);
+
+        cppsocket::Socket server(serverNetwork);
+        cppsocket::SocketHandle serverClient;
+        bool running = true;
+
+        server.setBlocking(false);
+        server.startAccept(cppsocket::ANY_ADDRESS, port);
+        // the accepted sockets are timestamped too
+        if (timestamping) server.setTimestamping(true);
+        server.setAcceptCallback([&serverClient](cppsocket::Socket&, cppsocket::Socket& c) {
+            serverClient = c.getHandle();
+            c.startRead();
+            c.setReadCallback([](cppsocket::Socket& socket, const std::vector<uint8_t>& data) {
+                socket.send(data);
+            });
+        });
+
+        std::thread serverThread([&serverNetwork, &running, serverCpu]() {
+            if (serverCpu >= 0) cppsocket::Network::setThreadAffinity(static_cast<uint32_t>(serverCpu));
+
+            while (running)
+                serverNetwork.update(-1.0f);
+        });
+
+        if (clientCpu >= 0) cppsocket::Network::setThreadAffinity(static_cast<uint32_t>(clientCpu));
+
+        cppsocket::Network clientNetwork;
+        clientNetwork.setSpinTime(spin / 1000000.0f);
+        clientNetwork.setBusyPollTime(busyPoll);
+
+        cppsocket::Socket client(clientNetwork);
+        std::vector<uint8_t> message(size, 'x');
+        std::vector<int64_t> samples;
+        samples.reserve(messages);
+        size_t received = 0;
+        size_t sent = 0;
+        bool done = false;
+        bool failed = false;
+        std::chrono::steady_clock::time_point sendTime;
+
+        auto sendMessage = [&](cppsocket::Socket& socket) {
+            sendTime = std::chrono::steady_clock::now();
+            socket.send(message);
+            ++sent;
+        };
+
+        client.setBlocking(false);
+        if (timestamping) client.setTimestamping(true);
+        client.setConnectCallback(sendMessage);
+        client.setConnectErrorCallback([&done, &failed](cppsocket::Socket&) {
+            done = failed = true;
+        });
+        client.setReadCallback([&](cppsocket::Socket& socket, const std::vector<uint8_t>& data) {
+            received += data.size();
+
+            if (received >= size)
+            {
+                received -= size;
+
+                if (sent == warmup && timestamping)
+                {
+                    socket.resetLatencyStats();
+                    serverNetwork.post([&serverNetwork, &serverClient]() {
+                        if (cppsocket::Socket* serverSocket = serverNetwork.getSocket(serverClient))
+                            serverSocket->resetLatencyStats();
+                    });
+                }
+
+                if (sent > warmup)
+                    samples.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - sendTime).count());
+
+                if (sent < warmup + messages)
+                    sendMessage(socket);
+                else
+                    done = true;
+            }
+        });
+        client.connect(cppsocket::ipToString(htonl(INADDR_LOOPBACK)) + ":" + std::to_string(port));
+
+        while (!done)
+            clientNetwork.update(-1.0f);
+
+        serverNetwork.post([&running]() { running = false; });
+        serverThread.join();
+
+        if (failed)
+            throw std::runtime_error("Failed to connect to the server");
+
+        std::sort(samples.begin(), samples.end());
+
+        std::cout << "Round trips: " << samples.size() << ", message size: " << size << " bytes" << std::endl;
+        std::cout << std::fixed << std::setprecision(1) <<
+            "p50: " << percentile(samples, 0.5) << " us" << std::endl <<
+            "p99: " << percentile(samples, 0.99) << " us" << std::endl <<
+            "p999: " << percentile(samples, 0.999) << " us" << std::endl <<
+            "max: " << samples.back() / 1000.0 << " us" << std::endl;
+
+        if (timestamping)
+        {
+            printLatencyStats("Client", *client.getLatencyStats());
+
+            // the server thread has finished, so its sockets can be accessed
+            if (cppsocket::Socket* serverSocket = serverNetwork.getSocket(serverClient))
+                printLatencyStats("Server", *serverSocket->getLatencyStats());
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    catch (...)
+    {
+        std::cerr << "Error" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,477 @@
+//
+//  cppsocket
+//
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <thread>
+#ifndef _WIN32
+#  include <sys/resource.h>
+#endif
+#include "Socket.hpp"
+#include "Histogram.hpp"
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    enum class Mode
+    {
+        Echo,
+        Sink
+    };
+
+    struct Options final
+    {
+        std::string address = "127.0.0.1:9000";
+        Mode mode = Mode::Echo;
+        size_t connections = 1000;
+        double rate = 10000.0;
+        size_t size = 64;
+        size_t pipeline = 1;
+        size_t churn = 0;
+        float warmup = 1.0f;
+        float duration = 10.0f;
+    };
+
+    void printUsage(const std::string& executable)
+    {
+        std::cout << "Usage: " << executable << " server [--address address] [--mode echo|sink]" << std::endl <<
+            "       " << executable << " client|loopback [--address address] [--mode echo|sink]" << std::endl <<
+            "    [--connections count] [--rate requests per second] [--size bytes] [--pipeline depth]" << std::endl <<
+            "    [--churn requests per connection] [--warmup seconds] [--duration seconds]" << std::endl;
+    }
+
+    void raiseFileLimit()
+    {
+#ifndef _WIN32
+        rlimit limit;
+        if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+        {
+            limit.rlim_cur = limit.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &limit);
+        }
+#endif
+    }
+
+    void startServer(cppsocket::Socket& server, const Options& options)
+    {
+        const Mode mode = options.mode;
+
+        server.setBlocking(false);
+        server.setAcceptQueueSize(4096);
+        server.startAccept(options.address);
+        server.setAcceptCallback([mode](cppsocket::Socket&, cppsocket::Socket& client) {
+            client.startRead();
+
+            if (mode == Mode::Echo)
+                client.setReadCallback([](cppsocket::Socket& socket, const std::vector<uint8_t>& data) {
+                    socket.send(data);
+                });
+        });
+    }
+
+    // Sends requests at a fixed rate regardless of the responses (open loop), the latency is
+    // measured from the time the request was supposed to be sent to avoid coordinated omission
+    class LoadClient final
+    {
+    public:
+        LoadClient(cppsocket::Network& aNetwork, const Options& aOptions):
+            network(aNetwork), options(aOptions),
+            interval(options.connections / options.rate),
+            message(options.size, 'x')
+        {
+        }
+
+        void start()
+        {
+            const Clock::time_point startTime = Clock::now();
+            measureStart = startTime + toDuration(options.warmup);
+            measureEnd = measureStart + toDuration(options.duration);
+
+            connections.resize(options.connections);
+
+            for (size_t index = 0; index < connections.size(); ++index)
+            {
+                Connection& connection = connections[index];
+                connection.socket.reset(new cppsocket::Socket(network));
+                connection.socket->setBlocking(false);
+                connection.socket->setConnectTimeout(5.0f);
+                connection.socket->setConnectCallback([this, index](cppsocket::Socket&) { onConnect(index); });
+                connection.socket->setConnectErrorCallback([this, index](cppsocket::Socket&) { onConnectError(index); });
+                connection.socket->setCloseCallback([this, index](cppsocket::Socket&) { onClose(index); });
+                connection.socket->setReadCallback([this, index](cppsocket::Socket&, const std::vector<uint8_t>& data) {
+                    onRead(index, data.size());
+                });
+
+                // spread the first requests evenly over the interval
+                connection.nextSendTime = startTime + toDuration(interval * index / connections.size());
+                connect(index);
+                scheduleSend(index);
+            }
+        }
+
+        void countError()
+        {
+            if (isMeasuring(Clock::now())) ++errors;
+        }
+
+        bool isFinished() const
+        {
+            return Clock::now() >= measureEnd;
+        }
+
+        void printReport() const
+        {
+            const double seconds = options.duration;
+
+            std::cout << std::fixed << std::setprecision(1) <<
+                "Connections: " << options.connections << ", rate: " << options.rate << " req/s, size: " << options.size <<
+                " B, pipeline: " << options.pipeline << ", churn: " << options.churn <<
+                ", mode: " << (options.mode == Mode::Echo ? "echo" : "sink") << std::endl <<
+                "Requests: " << requests << " (" << requests / seconds << " req/s)";
+
+            if (options.mode == Mode::Echo)
+                std::cout << ", responses: " << responses << " (" << responses / seconds << " resp/s)";
+
+            std::cout << std::endl <<
+                "Throughput: " << sentBytes / seconds / 1000000.0 << " MB/s sent, " <<
+                receivedBytes / seconds / 1000000.0 << " MB/s received" << std::endl <<
+                "Connects: " << connects << ", connect errors: " << connectErrors <<
+                ", disconnects: " << disconnects << ", errors: " << errors << std::endl;
+
+            printLatency("Connect latency", connectLatency);
+            if (options.mode == Mode::Echo)
+                printLatency("Request latency", requestLatency);
+        }
+
+    private:
+        struct Connection final
+        {
+            std::unique_ptr<cppsocket::Socket> socket;
+            bool connected = false;
+            Clock::time_point connectTime;
+            Clock::time_point nextSendTime;
+            std::deque<Clock::time_point> backlog; // intended send times of the requests not sent yet
+            std::deque<Clock::time_point> inFlight; // intended send times of the requests sent
+            size_t receivedSize = 0;
+            size_t completed = 0;
+        };
+
+        static Clock::duration toDuration(double seconds)
+        {
+            return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+        }
+
+        bool isMeasuring(Clock::time_point time) const
+        {
+            return time >= measureStart && time < measureEnd;
+        }
+
+        static void printLatency(const std::string& title, const cppsocket::Histogram& histogram)
+        {
+            std::cout << title << " (us, " << histogram.getCount() << " samples): " <<
+                "min " << histogram.getMin() / 1000.0 <<
+                ", p50 " << histogram.getValueAtPercentile(50.0) / 1000.0 <<
+                ", p90 " << histogram.getValueAtPercentile(90.0) / 1000.0 <<
+                ", p99 " << histogram.getValueAtPercentile(99.0) / 1000.0 <<
+                ", p99.9 " << histogram.getValueAtPercentile(99.9) / 1000.0 <<
+                ", p99.99 " << histogram.getValueAtPercentile(99.99) / 1000.0 <<
+                ", max " << histogram.getMax() / 1000.0 << std::endl;
+        }
+
+        void connect(size_t index)
+        {
+            Connection& connection = connections[index];
+            connection.connected = false;
+            connection.connectTime = Clock::now();
+            connection.inFlight.clear();
+            connection.receivedSize = 0;
+            connection.completed = 0;
+
+            try
+            {
+                connection.socket->connect(options.address);
+            }
+            catch (const std::system_error&)
+            {
+                // the connect error callback schedules a retry
+            }
+        }
+
+        void scheduleSend(size_t index)
+        {
+            const float delay = std::chrono::duration<float>(connections[index].nextSendTime - Clock::now()).count();
+            network.addTimer(std::max(delay, 0.0f), [this, index]() { onSendTime(index); });
+        }
+
+        void onSendTime(size_t index)
+        {
+            if (isFinished()) return;
+
+            Connection& connection = connections[index];
+            const Clock::time_point currentTime = Clock::now();
+
+            // catch up with all the requests that were due since the last timer
+            while (connection.nextSendTime <= currentTime)
+            {
+                connection.backlog.push_back(connection.nextSendTime);
+                connection.nextSendTime += toDuration(interval);
+            }
+
+            sendRequests(index);
+            scheduleSend(index);
+        }
+
+        void sendRequests(size_t index)
+        {
+            Connection& connection = connections[index];
+
+            while (connection.connected && !connection.backlog.empty() &&
+                   (options.mode == Mode::Sink || connection.inFlight.size() < options.pipeline) &&
+                   (options.churn == 0 || connection.completed + connection.inFlight.size() < options.churn))
+            {
+                const Clock::time_point intendedTime = connection.backlog.front();
+                connection.backlog.pop_front();
+
+                connection.socket->send(message);
+
+                if (isMeasuring(intendedTime))
+                {
+                    ++requests;
+                    sentBytes += message.size();
+                }
+
+                if (options.mode == Mode::Echo)
+                    connection.inFlight.push_back(intendedTime);
+                else
+                    ++connection.completed;
+            }
+
+            if (options.churn != 0 && connection.completed >= options.churn)
+            {
+                connection.socket->close();
+                connect(index);
+            }
+        }
+
+        void onConnect(size_t index)
+        {
+            Connection& connection = connections[index];
+            connection.connected = true;
+
+            const Clock::time_point currentTime = Clock::now();
+            if (isMeasuring(currentTime))
+            {
+                ++connects;
+                connectLatency.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(currentTime - connection.connectTime).count()));
+            }
+
+            sendRequests(index);
+        }
+
+        void onConnectError(size_t index)
+        {
+            if (isMeasuring(Clock::now())) ++connectErrors;
+
+            network.addTimer(0.1f, [this, index]() {
+                if (!isFinished()) connect(index);
+            });
+        }
+
+        void onClose(size_t index)
+        {
+            if (isMeasuring(Clock::now())) ++disconnects;
+
+            if (!isFinished()) connect(index);
+        }
+
+        void onRead(size_t index, size_t size)
+        {
+            Connection& connection = connections[index];
+            const Clock::time_point currentTime = Clock::now();
+
+            if (isMeasuring(currentTime)) receivedBytes += size;
+
+            connection.receivedSize += size;
+
+            while (connection.receivedSize >= message.size() && !connection.inFlight.empty())
+            {
+                connection.receivedSize -= message.size();
+
+                const Clock::time_point intendedTime = connection.inFlight.front();
+                connection.inFlight.pop_front();
+                ++connection.completed;
+
+                if (isMeasuring(intendedTime))
+                {
+                    ++responses;
+                    requestLatency.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(currentTime - intendedTime).count()));
+                }
+            }
+
+            sendRequests(index);
+        }
+
+        cppsocket::Network& network;
+        const Options options;
+        const double interval;
+        const std::vector<uint8_t> message;
+
+        std::vector<Connection> connections;
+        Clock::time_point measureStart;
+        Clock::time_point measureEnd;
+
+        uint64_t requests = 0;
+        uint64_t responses = 0;
+        uint64_t sentBytes = 0;
+        uint64_t receivedBytes = 0;
+        uint64_t connects = 0;
+        uint64_t connectErrors = 0;
+        uint64_t disconnects = 0;
+        uint64_t errors = 0;
+        cppsocket::Histogram connectLatency;
+        cppsocket::Histogram requestLatency;
+    };
+}
+
+int main(int argc, const char* argv[])
+{
+    try
+    {
+        if (argc < 2)
+        {
+            printUsage(argc ? argv[0] : "loadgen");
+            return EXIT_SUCCESS;
+        }
+
+        std::string type = argv[1];
+        Options options;
+
+        for (int i = 2; i < argc; ++i)
+        {
+            std::string argument = argv[i];
+
+            if (i + 1 >= argc)
+            {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+
+            std::string value = argv[++i];
+
+            if (argument == "--address") options.address = value;
+            else if (argument == "--mode" && (value == "echo" || value == "sink")) options.mode = (value == "echo") ? Mode::Echo : Mode::Sink;
+            else if (argument == "--connections") options.connections = std::stoul(value);
+            else if (argument == "--rate") options.rate = std::stod(value);
+            else if (argument == "--size") options.size = std::stoul(value);
+            else if (argument == "--pipeline") options.pipeline = std::stoul(value);
+            else if (argument == "--churn") options.churn = std::stoul(value);
+            else if (argument == "--warmup") options.warmup = std::stof(value);
+            else if (argument == "--duration") options.duration = std::stof(value);
+            else
+            {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+
+        if (options.connections == 0 || options.rate <= 0.0 || options.size == 0 ||
+            options.pipeline == 0 || options.duration <= 0.0f)
+        {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        raiseFileLimit();
+
+        if (type == "server")
+        {
+            cppsocket::Network network;
+            cppsocket::Socket server(network);
+            startServer(server, options);
+
+            for (;;)
+            {
+                try
+                {
+                    network.update(-1.0f);
+                }
+                catch (const std::system_error& e)
+                {
+                    // the failed connection has been closed, keep serving the others
+                    std::cerr << "Error: " << e.what() << std::endl;
+                }
+            }
+        }
+        else if (type == "client" || type == "loopback")
+        {
+            cppsocket::Network serverNetwork;
+            cppsocket::Socket server(serverNetwork);
+            bool running = true;
+            std::thread serverThread;
+
+            if (type == "loopback")
+            {
+                startServer(server, options);
+                serverThread = std::thread([&serverNetwork, &running]() {
+                    while (running)
+                    {
+                        try
+                        {
+                            serverNetwork.update(-1.0f);
+                        }
+                        catch (const std::system_error&)
+                        {
+                        }
+                    }
+                });
+            }
+
+            cppsocket::Network network;
+            LoadClient client(network, options);
+            client.start();
+
+            while (!client.isFinished())
+            {
+                try
+                {
+                    network.update(0.1f);
+                }
+                catch (const std::system_error&)
+                {
+                    client.countError();
+                }
+            }
+
+            if (serverThread.joinable())
+            {
+                serverNetwork.post([&running]() { running = false; });
+                serverThread.join();
+            }
+
+            client.printReport();
+        }
+        else
+        {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    catch (...)
+    {
+        std::cerr << "Error" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,141 @@
+//
+//  cppsocket
+//
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include "Socket.hpp"
+
+static void printUsage(const std::string& executable)
+{
+    std::cout << "Usage: " << executable << " [--port port] [--size megabytes] [--chunk kilobytes] [--copy]" << std::endl;
+}
+
+int main(int argc, const char* argv[])
+{
+    try
+    {
+        uint16_t port = 9000;
+        size_t total = 1024 * 1024 * 1024;
+        size_t chunkSize = 256 * 1024;
+        bool copy = false;
+
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string argument = argv[i];
+
+            if (argument == "--copy")
+                copy = true;
+            else if (i + 1 < argc && argument == "--port")
+                port = static_cast<uint16_t>(std::stoul(argv[++i]));
+            else if (i + 1 < argc && argument == "--size")
+                total = std::stoul(argv[++i]) * 1024 * 1024;
+            else if (i + 1 < argc && argument == "--chunk")
+                chunkSize = std::stoul(argv[++i]) * 1024;
+            else
+            {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+
+        if (total == 0 || chunkSize == 0)
+        {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        const std::string loopback = cppsocket::ipToString(htonl(INADDR_LOOPBACK));
+        const uint16_t relayPort = port;
+        const uint16_t backendPort = static_cast<uint16_t>(port + 1);
+
+        cppsocket::Network network;
+
+        // backend discards everything it receives
+        size_t received = 0;
+        cppsocket::Socket backendServer(network);
+        backendServer.setBlocking(false);
+        backendServer.startAccept(cppsocket::ANY_ADDRESS, backendPort);
+        backendServer.setAcceptCallback([&received](cppsocket::Socket&, cppsocket::Socket& c) {
+            c.startRead();
+            c.setReadCallback([&received](cppsocket::Socket&, const std::vector<uint8_t>& data) {
+                received += data.size();
+            });
+        });
+
+        // relay connects every client to the backend
+        std::vector<std::unique_ptr<cppsocket::Socket>> backendClients;
+        cppsocket::Socket relayServer(network);
+        relayServer.setBlocking(false);
+        relayServer.startAccept(cppsocket::ANY_ADDRESS, relayPort);
+        relayServer.setAcceptCallback([&](cppsocket::Socket&, cppsocket::Socket& c) {
+            backendClients.emplace_back(new cppsocket::Socket(network));
+            cppsocket::Socket& backend = *backendClients.back();
+            backend.setBlocking(false);
+            backend.connect(loopback + ":" + std::to_string(backendPort));
+
+            if (copy)
+            {
+                const cppsocket::SocketHandle clientHandle = c.getHandle();
+                const cppsocket::SocketHandle backendHandle = backend.getHandle();
+
+                c.setReadCallback([&network, backendHandle](cppsocket::Socket&, const std::vector<uint8_t>& data) {
+                    if (cppsocket::Socket* socket = network.getSocket(backendHandle))
+                        socket->send(data);
+                });
+                backend.setReadCallback([&network, clientHandle](cppsocket::Socket&, const std::vector<uint8_t>& data) {
+                    if (cppsocket::Socket* socket = network.getSocket(clientHandle))
+                        socket->send(data);
+                });
+            }
+            else
+                c.proxy(backend);
+        });
+
+        // client sends the data as fast as the relay takes it
+        const std::vector<uint8_t> chunk(chunkSize, 'x');
+        size_t sent = 0;
+        bool failed = false;
+        cppsocket::Socket client(network);
+        client.setBlocking(false);
+        client.setConnectErrorCallback([&failed](cppsocket::Socket&) { failed = true; });
+        client.connect(loopback + ":" + std::to_string(relayPort));
+
+        const auto startTime = std::chrono::steady_clock::now();
+
+        while (received < total && !failed)
+        {
+            if (client.isReady() && !client.hasOutData() && sent < total)
+            {
+                client.send(chunk);
+                sent += chunk.size();
+            }
+
+            network.update(-1.0f);
+        }
+
+        if (failed)
+            throw std::runtime_error("Failed to connect to the relay");
+
+        const float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - startTime).count();
+
+        std::cout << std::fixed << std::setprecision(1) <<
+            "Mode: " << (copy ? "copy" : "splice") << ", relayed " << received / (1024.0 * 1024.0) << " MiB in " <<
+            seconds << " s, " << received / (1024.0 * 1024.0) / seconds << " MiB/s" << std::endl;
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    catch (...)
+    {
+        std::cerr << "Error" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
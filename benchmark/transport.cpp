@@ -0,0 +1,161 @@
+//
+//  cppsocket
+//
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include "Socket.hpp"
+#include "MemoryTransport.hpp"
+
+// Runs the echo of the same messages over the memory transport and over the kernel,
+// the difference between the two is the cost of the kernel TCP stack
+static void printUsage(const std::string& executable)
+{
+    std::cout << "Usage: " << executable << " [--transport memory|system|both] [--port port]" << std::endl <<
+        "    [--connections count] [--size bytes] [--pipeline depth] [--duration seconds]" << std::endl;
+}
+
+static void run(cppsocket::Transport& transport, const std::string& name, uint16_t port,
+                size_t connections, size_t size, size_t pipeline, float duration)
+{
+    cppsocket::Network network(transport);
+    cppsocket::Socket server(network);
+
+    server.setBlocking(false);
+    server.setAcceptQueueSize(static_cast<int>(connections));
+    server.startAccept(cppsocket::ANY_ADDRESS, port);
+    server.setAcceptCallback([](cppsocket::Socket&, cppsocket::Socket& c) {
+        c.startRead();
+        c.setReadCallback([](cppsocket::Socket& socket, const std::vector<uint8_t>& data) {
+            socket.send(data);
+        });
+    });
+
+    const std::vector<uint8_t> message(size, 'x');
+    std::vector<std::unique_ptr<cppsocket::Socket>> clients;
+    std::vector<size_t> received(connections, 0);
+    uint64_t messages = 0;
+    size_t connected = 0;
+    bool failed = false;
+
+    for (size_t i = 0; i < connections; ++i)
+    {
+        clients.push_back(std::unique_ptr<cppsocket::Socket>(new cppsocket::Socket(network)));
+        cppsocket::Socket& client = *clients.back();
+
+        client.setBlocking(false);
+        client.setConnectCallback([&message, &connected, pipeline](cppsocket::Socket& socket) {
+            ++connected;
+            for (size_t p = 0; p < pipeline; ++p)
+                socket.send(message);
+        });
+        client.setConnectErrorCallback([&failed](cppsocket::Socket&) {
+            failed = true;
+        });
+        client.setReadCallback([&message, &received, &messages, size, i](cppsocket::Socket& socket, const std::vector<uint8_t>& data) {
+            received[i] += data.size();
+
+            // every echoed message is sent again
+            while (received[i] >= size)
+            {
+                received[i] -= size;
+                ++messages;
+                socket.send(message);
+            }
+        });
+        client.connect(cppsocket::ipToString(htonl(INADDR_LOOPBACK)) + ":" + std::to_string(port));
+    }
+
+    while (connected < connections && !failed)
+        network.update(-1.0f);
+
+    if (failed)
+        throw std::runtime_error("Failed to connect to the server");
+
+    messages = 0;
+    uint64_t updates = 0;
+    const auto startTime = std::chrono::steady_clock::now();
+    std::chrono::duration<float> elapsed(0.0f);
+
+    while (elapsed.count() < duration)
+    {
+        network.update(-1.0f);
+        ++updates;
+        elapsed = std::chrono::steady_clock::now() - startTime;
+    }
+
+    std::cout << std::fixed << std::setprecision(0) << name << ": " <<
+        messages / elapsed.count() << " messages/s, " <<
+        messages * size * 2 / elapsed.count() / (1024.0 * 1024.0) << " MiB/s, " <<
+        std::setprecision(1) << elapsed.count() * 1000000000.0 / (messages ? messages : 1) << " ns per round trip, " <<
+        std::setprecision(0) << updates / elapsed.count() << " updates/s" << std::endl;
+}
+
+int main(int argc, const char* argv[])
+{
+    try
+    {
+        std::string transport = "both";
+        uint16_t port = 9000;
+        size_t connections = 16;
+        size_t size = 64;
+        size_t pipeline = 1;
+        float duration = 3.0f;
+
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string argument = argv[i];
+
+            if (i + 1 >= argc)
+            {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+
+            std::string value = argv[++i];
+
+            if (argument == "--transport") transport = value;
+            else if (argument == "--port") port = static_cast<uint16_t>(std::stoul(value));
+            else if (argument == "--connections") connections = std::stoul(value);
+            else if (argument == "--size") size = std::stoul(value);
+            else if (argument == "--pipeline") pipeline = std::stoul(value);
+            else if (argument == "--duration") duration = std::stof(value);
+            else
+            {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+
+        if ((transport != "memory" && transport != "system" && transport != "both") ||
+            connections == 0 || size == 0 || pipeline == 0)
+        {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        if (transport != "system")
+        {
+            cppsocket::MemoryTransport memoryTransport;
+            run(memoryTransport, "memory", port, connections, size, pipeline, duration);
+        }
+
+        if (transport != "memory")
+            run(cppsocket::getSystemTransport(), "system", port, connections, size, pipeline, duration);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    catch (...)
+    {
+        std::cerr << "Error" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,211 @@
+//
+//  cppsocket
+//
+
+#ifndef CPPSOCKET_BROADCASTHUB_HPP
+#define CPPSOCKET_BROADCASTHUB_HPP
+
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Socket.hpp"
+
+namespace cppsocket
+{
+    // What is done with a message for a subscriber whose queued data would exceed the limit of the hub
+    enum class SlowConsumerPolicy
+    {
+        Drop, // the subscriber misses the message
+        Conflate, // the message replaces the unsent message of the same topic, or is queued if there is none
+        Disconnect // the queued data is discarded and the subscriber is closed
+    };
+
+    struct BroadcastStats final
+    {
+        uint64_t messagesPublished = 0;
+        uint64_t messagesQueued = 0; // one for every subscriber
+        uint64_t messagesDropped = 0;
+        uint64_t messagesConflated = 0;
+        uint64_t subscribersDisconnected = 0;
+    };
+
+    // Publishes messages to the sockets subscribed to a topic, every message is one shared buffer
+    // that is queued on all the subscribers without copying it. The subscribers are followed by their
+    // handles, so they can be moved, and are removed when they are destroyed.
+    // Can be used only from the thread calling update of the network
+    class BroadcastHub final
+    {
+    public:
+        explicit BroadcastHub(Network& aNetwork,
+                              SlowConsumerPolicy aPolicy = SlowConsumerPolicy::Drop,
+                              size_t aMaxQueuedSize = 1024 * 1024):
+            network(aNetwork), policy(aPolicy), maxQueuedSize(aMaxQueuedSize)
+        {
+        }
+
+        BroadcastHub(const BroadcastHub&) = delete;
+        BroadcastHub& operator=(const BroadcastHub&) = delete;
+
+        void subscribe(const std::string& topic, const Socket& socket)
+        {
+            auto i = topics.find(topic);
+
+            if (i == topics.end())
+            {
+                // the tags have to be unique among all hubs, because a socket can subscribe to many
+                static std::atomic<uint64_t> lastTag{0};
+
+                i = topics.insert(std::make_pair(topic, Topic())).first;
+                i->second.tag = ++lastTag;
+            }
+
+            std::vector<SocketHandle>& subscribers = i->second.subscribers;
+
+            if (std::find(subscribers.begin(), subscribers.end(), socket.getHandle()) == subscribers.end())
+                subscribers.push_back(socket.getHandle());
+        }
+
+        void unsubscribe(const std::string& topic, const Socket& socket)
+        {
+            auto i = topics.find(topic);
+            if (i == topics.end()) return;
+
+            removeSubscriber(i->second, socket.getHandle());
+
+            if (i->second.subscribers.empty())
+                topics.erase(i);
+        }
+
+        // Unsubscribes the socket from all topics
+        void unsubscribe(const Socket& socket)
+        {
+            for (auto i = topics.begin(); i != topics.end();)
+            {
+                removeSubscriber(i->second, socket.getHandle());
+
+                if (i->second.subscribers.empty())
+                    i = topics.erase(i);
+                else
+                    ++i;
+            }
+        }
+
+        size_t getSubscriberCount(const std::string& topic) const
+        {
+            auto i = topics.find(topic);
+            return (i == topics.end()) ? 0 : i->second.subscribers.size();
+        }
+
+        size_t publish(const std::string& topic, std::vector<uint8_t> message)
+        {
+            return publish(topic, makeSharedBuffer(std::move(message)));
+        }
+
+        // Returns the number of subscribers the message was queued on
+        size_t publish(const std::string& topic, const SharedBuffer& message)
+        {
+            auto i = topics.find(topic);
+            if (i == topics.end() || !message || message->empty()) return 0;
+
+            Topic& entry = i->second;
+            size_t queued = 0;
+
+            ++stats.messagesPublished;
+
+            for (size_t index = 0; index < entry.subscribers.size();)
+            {
+                Socket* socket = network.getSocket(entry.subscribers[index]);
+
+                if (!socket)
+                {
+                    entry.subscribers[index] = entry.subscribers.back();
+                    entry.subscribers.pop_back();
+                    continue;
+                }
+
+                if (!socket->isReady() || socket->isAccepting())
+                {
+                    ++index;
+                    continue;
+                }
+
+                if (maxQueuedSize && socket->getOutDataSize() + message->size() > maxQueuedSize)
+                {
+                    if (policy == SlowConsumerPolicy::Drop)
+                    {
+                        ++stats.messagesDropped;
+                        ++index;
+                        continue;
+                    }
+                    else if (policy == SlowConsumerPolicy::Disconnect)
+                    {
+                        ++stats.subscribersDisconnected;
+
+                        // the socket would otherwise try to write its backlog before closing
+                        socket->clearOutData();
+                        socket->close();
+
+                        entry.subscribers[index] = entry.subscribers.back();
+                        entry.subscribers.pop_back();
+                        continue;
+                    }
+                    else if (socket->replaceShared(message, entry.tag))
+                    {
+                        ++stats.messagesConflated;
+                        ++index;
+                        continue;
+                    }
+                }
+
+                socket->sendShared(message, entry.tag);
+                ++stats.messagesQueued;
+                ++queued;
+                ++index;
+            }
+
+            if (entry.subscribers.empty())
+                topics.erase(i);
+
+            return queued;
+        }
+
+        SlowConsumerPolicy getPolicy() const { return policy; }
+        void setPolicy(SlowConsumerPolicy newPolicy) { policy = newPolicy; }
+
+        // Limit of the data queued on a subscriber (including the data not sent through the hub), 0 means no limit
+        size_t getMaxQueuedSize() const { return maxQueuedSize; }
+        void setMaxQueuedSize(size_t newMaxQueuedSize) { maxQueuedSize = newMaxQueuedSize; }
+
+        const BroadcastStats& getStats() const { return stats; }
+        void resetStats() { stats = BroadcastStats(); }
+
+    private:
+        struct Topic final
+        {
+            uint64_t tag = 0; // identifies the messages of the topic for conflation
+            std::vector<SocketHandle> subscribers;
+        };
+
+        static void removeSubscriber(Topic& topic, SocketHandle handle)
+        {
+            auto i = std::find(topic.subscribers.begin(), topic.subscribers.end(), handle);
+
+            if (i != topic.subscribers.end())
+            {
+                *i = topic.subscribers.back();
+                topic.subscribers.pop_back();
+            }
+        }
+
+        Network& network;
+        SlowConsumerPolicy policy;
+        size_t maxQueuedSize;
+        std::unordered_map<std::string, Topic> topics;
+        BroadcastStats stats;
+    };
+}
+
+#endif // CPPSOCKET_BROADCASTHUB_HPP
@@ -0,0 +1,135 @@
+//
+//  cppsocket
+//
+
+#ifndef CPPSOCKET_HISTOGRAM_HPP
+#define CPPSOCKET_HISTOGRAM_HPP
+
+#include <cstdint>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+namespace cppsocket
+{
+    // Log-linear histogram in the style of HdrHistogram, the values are recorded with a relative error
+    // of at most 1/2^(subBucketBits - 1) and the values of valueBits bits or more are counted as the
+    // largest value of valueBits bits (the maximum is kept exactly). The buckets are allocated on the first record
+    class Histogram final
+    {
+    public:
+        explicit Histogram(uint32_t aSubBucketBits = 8, uint32_t aValueBits = 64):
+            subBucketBits(aSubBucketBits), valueBits(aValueBits),
+            subBucketCount(static_cast<uint64_t>(1) << aSubBucketBits),
+            subBucketHalfCount(subBucketCount / 2),
+            maxValue((aValueBits < 64) ? (static_cast<uint64_t>(1) << aValueBits) - 1 : std::numeric_limits<uint64_t>::max())
+        {
+            if (aSubBucketBits < 1 || aSubBucketBits > 16 || aValueBits <= aSubBucketBits || aValueBits > 64)
+                throw std::runtime_error("Invalid histogram precision");
+        }
+
+        void record(uint64_t value)
+        {
+            if (counts.empty())
+                counts.resize(subBucketCount + (valueBits - subBucketBits) * subBucketHalfCount);
+
+            ++counts[getIndex(std::min(value, maxValue))];
+            ++count;
+            sum += static_cast<double>(value);
+            if (value < min) min = value;
+            if (value > max) max = value;
+        }
+
+        void merge(const Histogram& other)
+        {
+            if (subBucketBits != other.subBucketBits || valueBits != other.valueBits)
+                throw std::runtime_error("Histograms of different precision can not be merged");
+
+            if (counts.empty())
+                counts.resize(other.counts.size());
+
+            for (size_t i = 0; i < other.counts.size(); ++i)
+                counts[i] += other.counts[i];
+
+            count += other.count;
+            sum += other.sum;
+            min = std::min(min, other.min);
+            max = std::max(max, other.max);
+        }
+
+        void reset()
+        {
+            std::fill(counts.begin(), counts.end(), 0);
+            count = 0;
+            sum = 0.0;
+            min = std::numeric_limits<uint64_t>::max();
+            max = 0;
+        }
+
+        uint64_t getCount() const { return count; }
+        uint64_t getMin() const { return count ? min : 0; }
+        uint64_t getMax() const { return max; }
+        double getMean() const { return count ? sum / count : 0.0; }
+
+        // percentile is in the range [0, 100]
+        uint64_t getValueAtPercentile(double percentile) const
+        {
+            if (count == 0) return 0;
+
+            uint64_t target = static_cast<uint64_t>(percentile / 100.0 * count + 0.5);
+            if (target < 1) target = 1;
+            if (target > count) target = count;
+
+            uint64_t total = 0;
+            for (size_t i = 0; i < counts.size(); ++i)
+            {
+                total += counts[i];
+                if (total >= target)
+                    return std::min(getHighestValue(i), max);
+            }
+
+            return max;
+        }
+
+    private:
+        static uint32_t getHighestBit(uint64_t value)
+        {
+            uint32_t bit = 0;
+            while (value >>= 1) ++bit;
+            return bit;
+        }
+
+        size_t getIndex(uint64_t value) const
+        {
+            if (value < subBucketCount) return static_cast<size_t>(value);
+
+            // values in [2^(shift + subBucketBits - 1), 2^(shift + subBucketBits)) share buckets of 2^shift
+            const uint32_t shift = getHighestBit(value) - (subBucketBits - 1);
+            return static_cast<size_t>(subBucketCount + (shift - 1) * subBucketHalfCount +
+                                       ((value >> shift) - subBucketHalfCount));
+        }
+
+        uint64_t getHighestValue(size_t index) const
+        {
+            if (index < subBucketCount) return index;
+
+            const uint64_t shift = (index - subBucketCount) / subBucketHalfCount + 1;
+            const uint64_t subBucket = (index - subBucketCount) % subBucketHalfCount + subBucketHalfCount;
+            return ((subBucket + 1) << shift) - 1;
+        }
+
+        uint32_t subBucketBits;
+        uint32_t valueBits;
+        uint64_t subBucketCount;
+        uint64_t subBucketHalfCount;
+        uint64_t maxValue;
+        std::vector<uint64_t> counts;
+        uint64_t count = 0;
+        double sum = 0.0;
+        uint64_t min = std::numeric_limits<uint64_t>::max();
+        uint64_t max = 0;
+    };
+}
+
+#endif // CPPSOCKET_HISTOGRAM_HPP
@@ -0,0 +1,399 @@
+//
+//  cppsocket
+//
+
+#ifndef CPPSOCKET_MEMORYTRANSPORT_HPP
+#define CPPSOCKET_MEMORYTRANSPORT_HPP
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+#include "Socket.hpp"
+
+namespace cppsocket
+{
+    // Connects the sockets in the same process through ring buffers without the kernel, so the
+    // overhead of the library can be measured and tested on its own. All addresses are local, a
+    // connect to a port reaches the socket listening on it regardless of the address. Not thread-safe,
+    // all networks using the transport have to be updated from the same thread. Only the waker of the
+    // network is polled in the kernel, so an update blocks only if none of the memory sockets are ready
+    class MemoryTransport final: public Transport
+    {
+    public:
+        static constexpr size_t DEFAULT_BUFFER_SIZE = 262144;
+
+        explicit MemoryTransport(size_t aBufferSize = DEFAULT_BUFFER_SIZE):
+            bufferSize(aBufferSize)
+        {
+        }
+
+        socket_t createSocket() override
+        {
+            const socket_t socketFd = nextFd++;
+            endpoints[socketFd];
+            return socketFd;
+        }
+
+        int closeSocket(socket_t socketFd) override
+        {
+            auto i = endpoints.find(socketFd);
+            if (i == endpoints.end()) return fail(EBADF);
+
+            Endpoint& endpoint = i->second;
+
+            if (endpoint.state == State::Listening)
+            {
+                listeners.erase(endpoint.localPort);
+
+                // the connections that were not accepted are closed too
+                for (socket_t pendingFd : endpoint.pendingConnections)
+                    closeSocket(pendingFd);
+            }
+
+            if (Endpoint* peer = getEndpoint(endpoint.peer))
+            {
+                // the peer reads the buffered data and then the end of the stream
+                peer->peer = NULL_SOCKET;
+                peer->peerClosed = true;
+            }
+
+            endpoints.erase(socketFd);
+            return 0;
+        }
+
+        // memory sockets never wait, only a blocking connect reports its result right away
+        int setBlocking(socket_t socketFd, bool block) override
+        {
+            Endpoint* endpoint = getEndpoint(socketFd);
+            if (!endpoint) return fail(EBADF);
+
+            endpoint->blocking = block;
+            return 0;
+        }
+
+        int setOption(socket_t socketFd, int, int, const void*, socklen_t) override
+        {
+            // there are no options for memory sockets
+            return getEndpoint(socketFd) ? 0 : fail(EBADF);
+        }
+
+        int getError(socket_t socketFd, int& error) override
+        {
+            Endpoint* endpoint = getEndpoint(socketFd);
+            if (!endpoint) return fail(EBADF);
+
+            error = endpoint->error;
+            endpoint->error = 0;
+            return 0;
+        }
+
+        int bind(socket_t socketFd, const sockaddr_in& address) override
+        {
+            Endpoint* endpoint = getEndpoint(socketFd);
+            if (!endpoint) return fail(EBADF);
+            if (endpoint->state != State::Created) return fail(EINVAL);
+
+            uint16_t port = ntohs(address.sin_port);
+
+            if (port == ANY_PORT)
+                port = getEphemeralPort();
+            else if (listeners.find(port) != listeners.end())
+                return fail(EADDRINUSE);
+
+            endpoint->localAddress = address.sin_addr.s_addr;
+            endpoint->localPort = port;
+            endpoint->state = State::Bound;
+            return 0;
+        }
+
+        // the queue size is not limited, a connect is never refused because of it
+        int listen(socket_t socketFd, int) override
+        {
+            Endpoint* endpoint = getEndpoint(socketFd);
+            if (!endpoint) return fail(EBADF);
+
+            if (endpoint->state == State::Created)
+            {
+                endpoint->localPort = getEphemeralPort();
+                endpoint->state = State::Bound;
+            }
+
+            if (endpoint->state != State::Bound) return fail(EINVAL);
+            if (listeners.find(endpoint->localPort) != listeners.end()) return fail(EADDRINUSE);
+
+            listeners[endpoint->localPort] = socketFd;
+            endpoint->state = State::Listening;
+            return 0;
+        }
+
+        int connect(socket_t socketFd, const sockaddr_in& address) override
+        {
+            Endpoint* endpoint = getEndpoint(socketFd);
+            if (!endpoint) return fail(EBADF);
+            if (endpoint->state != State::Created && endpoint->state != State::Bound) return fail(EISCONN);
+
+            if (endpoint->state == State::Created)
+            {
+                endpoint->localAddress = htonl(INADDR_LOOPBACK);
+                endpoint->localPort = getEphemeralPort();
+            }
+
+            endpoint->remoteAddress = address.sin_addr.s_addr;
+            endpoint->remotePort = ntohs(address.sin_port);
+
+            auto listener = listeners.find(endpoint->remotePort);
+
+            if (listener == listeners.end())
+            {
+                endpoint->state = State::Failed;
+
+                if (endpoint->blocking)
+                    return fail(ECONNREFUSED);
+
+                // reported by poll and getError like the kernel does
+                endpoint->error = ECONNREFUSED;
+                return fail(IN_PROGRESS);
+            }
+
+            // the endpoint of the server side waits in the queue of the listening socket until it is accepted
+            const socket_t serverFd = createSocket();
+            Endpoint& serverEndpoint = endpoints[serverFd];
+            endpoint = getEndpoint(socketFd); // the map could have been rehashed
+            Endpoint& listeningEndpoint = endpoints[listener->second];
+
+            serverEndpoint.state = State::Connected;
+            serverEndpoint.localAddress = (listeningEndpoint.localAddress != ANY_ADDRESS) ?
+                listeningEndpoint.localAddress : endpoint->remoteAddress;
+            serverEndpoint.localPort = listeningEndpoint.localPort;
+            serverEndpoint.remoteAddress = endpoint->localAddress;
+            serverEndpoint.remotePort = endpoint->localPort;
+            serverEndpoint.peer = socketFd;
+            serverEndpoint.inData.resize(bufferSize);
+
+            endpoint->state = State::Connected;
+            endpoint->peer = serverFd;
+            endpoint->inData.resize(bufferSize);
+
+            listeningEndpoint.pendingConnections.push_back(serverFd);
+
+            return endpoint->blocking ? 0 : fail(IN_PROGRESS);
+        }
+
+        socket_t accept(socket_t socketFd, sockaddr_in& address) override
+        {
+            Endpoint* endpoint = getEndpoint(socketFd);
+            if (!endpoint) return static_cast<socket_t>(fail(EBADF));
+            if (endpoint->state != State::Listening) return static_cast<socket_t>(fail(EINVAL));
+            if (endpoint->pendingConnections.empty()) return static_cast<socket_t>(fail(WOULD_BLOCK));
+
+            const socket_t clientFd = endpoint->pendingConnections.front();
+            endpoint->pendingConnections.pop_front();
+
+            const Endpoint& clientEndpoint = endpoints[clientFd];
+            std::memset(&address, 0, sizeof(address));
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = clientEndpoint.remoteAddress;
+            address.sin_port = htons(clientEndpoint.remotePort);
+
+            return clientFd;
+        }
+
+        int getLocalAddress(socket_t socketFd, sockaddr_in& address) override
+        {
+            Endpoint* endpoint = getEndpoint(socketFd);
+            if (!endpoint) return fail(EBADF);
+
+            std::memset(&address, 0, sizeof(address));
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = endpoint->localAddress;
+            address.sin_port = htons(endpoint->localPort);
+            return 0;
+        }
+
+        int64_t recv(socket_t socketFd, void* buffer, size_t size, int) override
+        {
+            Endpoint* endpoint = getEndpoint(socketFd);
+            if (!endpoint) return fail(EBADF);
+            if (endpoint->error) return fail(endpoint->error);
+            if (endpoint->state != State::Connected) return fail(ENOTCONN);
+
+            if (endpoint->inDataSize == 0)
+                return endpoint->peerClosed ? 0 : fail(WOULD_BLOCK);
+
+            size = std::min(size, endpoint->inDataSize);
+
+            // the data can wrap around the end of the ring buffer
+            const size_t firstSize = std::min(size, endpoint->inData.size() - endpoint->inDataOffset);
+            std::memcpy(buffer, endpoint->inData.data() + endpoint->inDataOffset, firstSize);
+            std::memcpy(static_cast<uint8_t*>(buffer) + firstSize, endpoint->inData.data(), size - firstSize);
+
+            endpoint->inDataOffset = (endpoint->inDataOffset + size) % endpoint->inData.size();
+            endpoint->inDataSize -= size;
+
+            return static_cast<int64_t>(size);
+        }
+
+        int64_t send(socket_t socketFd, const void* buffer, size_t size, int) override
+        {
+            Endpoint* endpoint = getEndpoint(socketFd);
+            if (!endpoint) return fail(EBADF);
+            if (endpoint->error) return fail(endpoint->error);
+            if (endpoint->state != State::Connected) return fail(ENOTCONN);
+
+            Endpoint* peer = getEndpoint(endpoint->peer);
+            if (!peer) return fail(EPIPE);
+
+            size = std::min(size, peer->inData.size() - peer->inDataSize);
+            if (size == 0) return fail(WOULD_BLOCK);
+
+            const size_t end = (peer->inDataOffset + peer->inDataSize) % peer->inData.size();
+            const size_t firstSize = std::min(size, peer->inData.size() - end);
+            std::memcpy(peer->inData.data() + end, buffer, firstSize);
+            std::memcpy(peer->inData.data(), static_cast<const uint8_t*>(buffer) + firstSize, size - firstSize);
+
+            peer->inDataSize += size;
+
+            return static_cast<int64_t>(size);
+        }
+
+        int poll(std::vector<pollfd>& pollFds, int timeout) override
+        {
+            int result = 0;
+            systemPollFds.clear();
+            systemPollIndices.clear();
+
+            for (size_t i = 0; i < pollFds.size(); ++i)
+            {
+                pollfd& pollFd = pollFds[i];
+                pollFd.revents = 0;
+
+                if (const Endpoint* endpoint = getEndpoint(pollFd.fd))
+                {
+                    pollFd.revents = getEvents(*endpoint) & (pollFd.events | POLLERR | POLLHUP);
+                    if (pollFd.revents) ++result;
+                }
+                else
+                {
+                    systemPollFds.push_back(pollFd);
+                    systemPollIndices.push_back(i);
+                }
+            }
+
+            if (!systemPollFds.empty())
+            {
+                // nothing can change the state of the memory sockets while waiting
+                int systemResult = getSystemTransport().poll(systemPollFds, result ? 0 : timeout);
+                if (systemResult < 0) return systemResult;
+
+                for (size_t i = 0; i < systemPollFds.size(); ++i)
+                    pollFds[systemPollIndices[i]].revents = systemPollFds[i].revents;
+
+                result += systemResult;
+            }
+
+            return result;
+        }
+
+    private:
+#ifdef _WIN32
+        static constexpr int WOULD_BLOCK = WSAEWOULDBLOCK;
+        static constexpr int IN_PROGRESS = WSAEWOULDBLOCK;
+#else
+        static constexpr int WOULD_BLOCK = EWOULDBLOCK;
+        static constexpr int IN_PROGRESS = EINPROGRESS;
+#endif
+        static constexpr socket_t FIRST_FD = 0x40000000;
+
+        enum class State
+        {
+            Created,
+            Bound,
+            Listening,
+            Connected,
+            Failed
+        };
+
+        struct Endpoint final
+        {
+            State state = State::Created;
+            bool blocking = true;
+            int error = 0;
+            uint32_t localAddress = ANY_ADDRESS;
+            uint16_t localPort = ANY_PORT;
+            uint32_t remoteAddress = ANY_ADDRESS;
+            uint16_t remotePort = ANY_PORT;
+
+            socket_t peer = NULL_SOCKET;
+            bool peerClosed = false;
+
+            // ring buffer of the data sent by the peer
+            std::vector<uint8_t> inData;
+            size_t inDataOffset = 0;
+            size_t inDataSize = 0;
+
+            std::deque<socket_t> pendingConnections;
+        };
+
+        static int fail(int error)
+        {
+#ifdef _WIN32
+            WSASetLastError(error);
+#else
+            errno = error;
+#endif
+            return -1;
+        }
+
+        Endpoint* getEndpoint(socket_t socketFd)
+        {
+            auto i = endpoints.find(socketFd);
+            return (i != endpoints.end()) ? &i->second : nullptr;
+        }
+
+        short getEvents(const Endpoint& endpoint)
+        {
+            switch (endpoint.state)
+            {
+                case State::Listening:
+                    return endpoint.pendingConnections.empty() ? 0 : POLLIN;
+                case State::Connected:
+                {
+                    short events = 0;
+                    if (endpoint.inDataSize > 0 || endpoint.peerClosed) events |= POLLIN;
+
+                    const Endpoint* peer = getEndpoint(endpoint.peer);
+                    if (!peer) events |= POLLOUT | POLLHUP; // a send fails right away
+                    else if (peer->inDataSize < peer->inData.size()) events |= POLLOUT;
+
+                    return events;
+                }
+                case State::Failed:
+                    return POLLIN | POLLOUT | POLLERR | POLLHUP;
+                default:
+                    return 0;
+            }
+        }
+
+        uint16_t getEphemeralPort()
+        {
+            for (;;)
+            {
+                const uint16_t port = nextPort;
+                nextPort = (nextPort == 65535) ? 49152 : nextPort + 1;
+                if (listeners.find(port) == listeners.end()) return port;
+            }
+        }
+
+        size_t bufferSize;
+        socket_t nextFd = FIRST_FD;
+        uint16_t nextPort = 49152;
+        std::unordered_map<socket_t, Endpoint> endpoints;
+        std::unordered_map<uint16_t, socket_t> listeners;
+        std::vector<pollfd> systemPollFds;
+        std::vector<size_t> systemPollIndices;
+    };
+}
+
+#endif // CPPSOCKET_MEMORYTRANSPORT_HPP
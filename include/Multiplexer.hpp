@@ -0,0 +1,460 @@
+//
+//  cppsocket
+//
+
+#ifndef CPPSOCKET_MULTIPLEXER_HPP
+#define CPPSOCKET_MULTIPLEXER_HPP
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+#include "Socket.hpp"
+
+namespace cppsocket
+{
+    // Frames are a big-endian 32-bit payload length and a big-endian 32-bit correlation ID followed by the payload
+    static constexpr size_t FRAME_HEADER_SIZE = 8;
+    static constexpr uint32_t MAX_FRAME_SIZE = 16 * 1024 * 1024;
+
+    // Throws if the payload is larger than MAX_FRAME_SIZE, the peer would drop the connection for it
+    inline std::vector<uint8_t> encodeFrame(uint32_t id, const std::vector<uint8_t>& payload)
+    {
+        if (payload.size() > MAX_FRAME_SIZE)
+            throw std::runtime_error("Frame too large");
+
+        const uint32_t size = static_cast<uint32_t>(payload.size());
+
+        std::vector<uint8_t> frame;
+        frame.reserve(FRAME_HEADER_SIZE + payload.size());
+        frame.push_back(static_cast<uint8_t>(size >> 24));
+        frame.push_back(static_cast<uint8_t>(size >> 16));
+        frame.push_back(static_cast<uint8_t>(size >> 8));
+        frame.push_back(static_cast<uint8_t>(size));
+        frame.push_back(static_cast<uint8_t>(id >> 24));
+        frame.push_back(static_cast<uint8_t>(id >> 16));
+        frame.push_back(static_cast<uint8_t>(id >> 8));
+        frame.push_back(static_cast<uint8_t>(id));
+        frame.insert(frame.end(), payload.begin(), payload.end());
+
+        return frame;
+    }
+
+    // Splits the stream read from a socket into frames
+    class FrameReader final
+    {
+    public:
+        // Calls the callback for every complete frame until it returns false,
+        // returns false if the stream contains a frame larger than MAX_FRAME_SIZE
+        bool read(const std::vector<uint8_t>& data,
+                  const std::function<bool(uint32_t, const std::vector<uint8_t>&)>& callback)
+        {
+            if (buffer.empty())
+            {
+                // the frames are parsed straight from the read data, only the incomplete frame is kept
+                size_t offset = 0;
+                if (!parse(data.data(), data.size(), offset, callback)) return false;
+                buffer.assign(data.begin() + static_cast<std::ptrdiff_t>(offset), data.end());
+            }
+            else
+            {
+                buffer.insert(buffer.end(), data.begin(), data.end());
+
+                size_t offset = 0;
+                if (!parse(buffer.data(), buffer.size(), offset, callback)) return false;
+                buffer.erase(buffer.begin(), buffer.begin() + static_cast<std::ptrdiff_t>(offset));
+            }
+
+            return true;
+        }
+
+        void reset()
+        {
+            buffer.clear();
+        }
+
+    private:
+        static uint32_t decodeUInt32(const uint8_t* data)
+        {
+            return (static_cast<uint32_t>(data[0]) << 24) |
+                (static_cast<uint32_t>(data[1]) << 16) |
+                (static_cast<uint32_t>(data[2]) << 8) |
+                static_cast<uint32_t>(data[3]);
+        }
+
+        bool parse(const uint8_t* data, size_t size, size_t& offset,
+                   const std::function<bool(uint32_t, const std::vector<uint8_t>&)>& callback)
+        {
+            while (size - offset >= FRAME_HEADER_SIZE)
+            {
+                const uint32_t payloadSize = decodeUInt32(data + offset);
+                const uint32_t id = decodeUInt32(data + offset + 4);
+
+                if (payloadSize > MAX_FRAME_SIZE)
+                    return false;
+
+                if (size - offset - FRAME_HEADER_SIZE < payloadSize)
+                    break;
+
+                const uint8_t* payloadData = data + offset + FRAME_HEADER_SIZE;
+                payload.assign(payloadData, payloadData + payloadSize);
+                offset += FRAME_HEADER_SIZE + payloadSize;
+
+                if (!callback(id, payload))
+                {
+                    // the rest of the data is dropped
+                    offset = size;
+                    break;
+                }
+            }
+
+            return true;
+        }
+
+        std::vector<uint8_t> buffer;
+        std::vector<uint8_t> payload;
+    };
+
+    // Sends requests over one connection without waiting for the previous responses,
+    // the responses can arrive in any order and are matched to the requests by their correlation IDs.
+    // The requests made while the socket is not connected are sent once it is, the requests sent on
+    // a previous connection fail with std::errc::connection_aborted when the socket connects again.
+    // The client takes over the read, connect and close callbacks of the socket, it follows the socket when
+    // it is moved and must not be destroyed from its own callbacks
+    class MultiplexedClient final
+    {
+    public:
+        using ResponseCallback = std::function<void(const std::error_code&, const std::vector<uint8_t>&)>;
+
+        MultiplexedClient(Socket& socket, size_t aMaxInFlight = 1024):
+            network(socket.getNetwork()), handle(socket.getHandle()), maxInFlight(aMaxInFlight)
+        {
+            socket.setReadCallback([this](Socket& s, const std::vector<uint8_t>& data) {
+                if (!reader.read(data, [this](uint32_t id, const std::vector<uint8_t>& response) { return handleResponse(id, response); }))
+                {
+                    s.close();
+                    reader.reset();
+                    failRequests(std::make_error_code(std::errc::bad_message));
+                }
+            });
+
+            socket.setConnectCallback([this](Socket& s) {
+                handleConnect();
+
+                if (connectCallback)
+                    connectCallback(s);
+            });
+
+            socket.setCloseCallback([this](Socket& s) {
+                reader.reset();
+                failRequests(std::make_error_code(std::errc::connection_aborted));
+
+                if (closeCallback)
+                    closeCallback(s);
+            });
+        }
+
+        ~MultiplexedClient()
+        {
+            for (const auto& request : requests)
+                if (request.second.timer)
+                    network.cancelTimer(request.second.timer);
+
+            if (Socket* socket = network.getSocket(handle))
+            {
+                socket->setReadCallback(nullptr);
+                socket->setConnectCallback(nullptr);
+                socket->setCloseCallback(nullptr);
+            }
+        }
+
+        MultiplexedClient(const MultiplexedClient&) = delete;
+        MultiplexedClient& operator=(const MultiplexedClient&) = delete;
+
+        // Requests over the in-flight limit wait in a queue, the timeout in seconds covers the time
+        // in the queue too (0 means no timeout), the callback gets std::errc::timed_out when it expires
+        void sendRequest(const std::vector<uint8_t>& request, const ResponseCallback& callback, float timeout = 10.0f)
+        {
+            Socket* socket = network.getSocket(handle);
+
+            if (!socket)
+                throw std::runtime_error("Invalid socket");
+
+            // skip the IDs of the requests that are still pending after a wrap-around
+            while (requests.find(nextId) != requests.end()) ++nextId;
+            const uint32_t id = nextId++;
+
+            Request& entry = requests[id];
+
+            try
+            {
+                if (inFlight < maxInFlight && socket->isReady())
+                {
+                    socket->send(encodeFrame(id, request));
+                    entry.sent = true;
+                    ++inFlight;
+                }
+                else
+                {
+                    entry.frame = encodeFrame(id, request);
+                    waitingRequests.push_back(id);
+                }
+            }
+            catch (...)
+            {
+                requests.erase(id);
+                throw;
+            }
+
+            entry.callback = callback;
+
+            if (timeout > 0.0f)
+                entry.timer = network.addTimer(timeout, std::bind(&MultiplexedClient::handleTimeout, this, id));
+        }
+
+        // Fails all pending requests with std::errc::operation_canceled
+        void cancelRequests()
+        {
+            failRequests(std::make_error_code(std::errc::operation_canceled));
+        }
+
+        size_t getMaxInFlight() const { return maxInFlight; }
+        void setMaxInFlight(size_t newMaxInFlight)
+        {
+            maxInFlight = newMaxInFlight;
+            sendWaitingRequests();
+        }
+
+        size_t getInFlightCount() const { return inFlight; }
+        size_t getPendingCount() const { return requests.size(); }
+
+        // Called after the client has handled the connect or close of the socket
+        void setConnectCallback(const std::function<void(Socket&)>& newConnectCallback)
+        {
+            connectCallback = newConnectCallback;
+        }
+
+        void setCloseCallback(const std::function<void(Socket&)>& newCloseCallback)
+        {
+            closeCallback = newCloseCallback;
+        }
+
+    private:
+        struct Request final
+        {
+            ResponseCallback callback;
+            Network::TimerId timer = 0;
+            std::vector<uint8_t> frame; // only while waiting to be sent
+            bool sent = false;
+        };
+
+        bool handleResponse(uint32_t id, const std::vector<uint8_t>& response)
+        {
+            auto i = requests.find(id);
+
+            // the request has timed out or been cancelled, or is still waiting to be sent, so the response is not for it
+            if (i == requests.end() || !i->second.sent) return true;
+
+            Request request = std::move(i->second);
+            requests.erase(i);
+
+            if (request.timer) network.cancelTimer(request.timer);
+            --inFlight;
+
+            sendWaitingRequests();
+
+            if (request.callback)
+                request.callback(std::error_code(), response);
+
+            // stop if the callback has closed the socket
+            Socket* socket = network.getSocket(handle);
+            return socket && socket->isReady();
+        }
+
+        void handleConnect()
+        {
+            // the data of the previous connection is gone, a user close or a connect of an open socket
+            // does not call the close callback
+            reader.reset();
+
+            std::unordered_map<uint32_t, Request> failedRequests;
+
+            for (auto i = requests.begin(); i != requests.end();)
+            {
+                if (i->second.sent)
+                {
+                    if (i->second.timer)
+                        network.cancelTimer(i->second.timer);
+
+                    failedRequests.insert(std::make_pair(i->first, std::move(i->second)));
+                    i = requests.erase(i);
+                }
+                else
+                    ++i;
+            }
+
+            inFlight = 0;
+
+            sendWaitingRequests();
+
+            const std::vector<uint8_t> empty;
+
+            for (auto& request : failedRequests)
+                if (request.second.callback)
+                    request.second.callback(std::make_error_code(std::errc::connection_aborted), empty);
+        }
+
+        void handleTimeout(uint32_t id)
+        {
+            auto i = requests.find(id);
+            if (i == requests.end()) return;
+
+            Request request = std::move(i->second);
+            requests.erase(i);
+
+            // a late response is ignored, so the request no longer counts against the limit
+            if (request.sent)
+            {
+                --inFlight;
+                sendWaitingRequests();
+            }
+
+            if (request.callback)
+                request.callback(std::make_error_code(std::errc::timed_out), std::vector<uint8_t>());
+        }
+
+        void sendWaitingRequests()
+        {
+            Socket* socket = network.getSocket(handle);
+            if (!socket || !socket->isReady()) return;
+
+            while (inFlight < maxInFlight && !waitingRequests.empty())
+            {
+                const uint32_t id = waitingRequests.front();
+                waitingRequests.pop_front();
+
+                auto i = requests.find(id);
+                if (i == requests.end() || i->second.sent) continue;
+
+                socket->send(std::move(i->second.frame));
+                i->second.frame.clear();
+                i->second.sent = true;
+                ++inFlight;
+            }
+        }
+
+        void failRequests(const std::error_code& error)
+        {
+            // the callbacks can send new requests
+            std::unordered_map<uint32_t, Request> failedRequests;
+            failedRequests.swap(requests);
+            waitingRequests.clear();
+            inFlight = 0;
+
+            for (auto& request : failedRequests)
+                if (request.second.timer)
+                    network.cancelTimer(request.second.timer);
+
+            const std::vector<uint8_t> empty;
+
+            for (auto& request : failedRequests)
+                if (request.second.callback)
+                    request.second.callback(error, empty);
+        }
+
+        Network& network;
+        SocketHandle handle;
+        size_t maxInFlight;
+        size_t inFlight = 0;
+        uint32_t nextId = 0;
+        std::unordered_map<uint32_t, Request> requests;
+        std::deque<uint32_t> waitingRequests;
+        FrameReader reader;
+        std::function<void(Socket&)> connectCallback;
+        std::function<void(Socket&)> closeCallback;
+    };
+
+    // Reads the framed requests on the sockets accepted by the listening socket,
+    // the responses can be sent later and in any order with sendResponse.
+    // The server takes over the accept callback of the listening socket, it follows the socket when
+    // it is moved and must not be destroyed from its own callbacks
+    class MultiplexedServer final
+    {
+    public:
+        using RequestCallback = std::function<void(Socket&, uint32_t, const std::vector<uint8_t>&)>;
+
+        MultiplexedServer(Socket& listener):
+            network(listener.getNetwork()), handle(listener.getHandle()), callbacks(std::make_shared<Callbacks>())
+        {
+            // the connections outlive the server, so they share the callbacks instead of pointing to it
+            std::shared_ptr<Callbacks> serverCallbacks = callbacks;
+
+            listener.setAcceptCallback([serverCallbacks](Socket&, Socket& client) {
+                // every connection has its own reader, it is destroyed together with the socket
+                std::shared_ptr<FrameReader> reader = std::make_shared<FrameReader>();
+
+                client.startRead();
+                client.setReadCallback([serverCallbacks, reader](Socket& socket, const std::vector<uint8_t>& data) {
+                    bool valid = reader->read(data, [&serverCallbacks, &socket](uint32_t id, const std::vector<uint8_t>& request) {
+                        if (serverCallbacks->requestCallback)
+                            serverCallbacks->requestCallback(socket, id, request);
+
+                        return socket.isReady();
+                    });
+
+                    if (!valid)
+                        socket.close();
+                });
+
+                if (serverCallbacks->acceptCallback)
+                    serverCallbacks->acceptCallback(client);
+            });
+        }
+
+        ~MultiplexedServer()
+        {
+            // the connections still read the frames, but no longer pass them on
+            callbacks->requestCallback = nullptr;
+            callbacks->acceptCallback = nullptr;
+
+            if (Socket* listener = network.getSocket(handle))
+                listener->setAcceptCallback(nullptr);
+        }
+
+        MultiplexedServer(const MultiplexedServer&) = delete;
+        MultiplexedServer& operator=(const MultiplexedServer&) = delete;
+
+        void setRequestCallback(const RequestCallback& newRequestCallback)
+        {
+            callbacks->requestCallback = newRequestCallback;
+        }
+
+        // Called for every accepted socket after the server has set its read callback
+        void setAcceptCallback(const std::function<void(Socket&)>& newAcceptCallback)
+        {
+            callbacks->acceptCallback = newAcceptCallback;
+        }
+
+        static void sendResponse(Socket& socket, uint32_t id, const std::vector<uint8_t>& response)
+        {
+            socket.send(encodeFrame(id, response));
+        }
+
+    private:
+        struct Callbacks final
+        {
+            RequestCallback requestCallback;
+            std::function<void(Socket&)> acceptCallback;
+        };
+
+        Network& network;
+        SocketHandle handle;
+        std::shared_ptr<Callbacks> callbacks;
+    };
+}
+
+#endif // CPPSOCKET_MULTIPLEXER_HPP
@@ -8,12 +8,19 @@
 #include <cstdint>
 #include <cstring>
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cmath>
+#include <deque>
 #include <functional>
-#include <set>
+#include <limits>
+#include <memory>
+#include <new>
 #include <stdexcept>
 #include <string>
 #include <system_error>
+#include <type_traits>
+#include <unordered_set>
 #include <vector>
 #ifdef _WIN32
 #  pragma push_macro("WIN32_LEAN_AND_MEAN")
@@ -32,11 +39,20 @@
 #  include <sys/socket.h>
 #  include <netdb.h>
 #  include <netinet/in.h>
+#  include <netinet/tcp.h>
 #  include <poll.h>
 #  include <unistd.h>
+#  ifdef __linux__
+#    include <sched.h>
+#    include <sys/eventfd.h>
+#    include <sys/ioctl.h>
+#    include <linux/errqueue.h>
+#    include <linux/net_tstamp.h>
+#  endif
 #endif
 #include <errno.h>
 #include <fcntl.h>
+#include "Histogram.hpp"
 
 namespace cppsocket
 {
@@ -51,6 +67,39 @@ namespace cppsocket
     static constexpr uint32_t ANY_ADDRESS = 0;
     static constexpr uint16_t ANY_PORT = 0;
     static constexpr int WAITING_QUEUE_SIZE = 5;
+    static constexpr size_t MAX_ACCEPTS_PER_UPDATE = 64;
+    // maximum amount of relayed data buffered between two sockets
+    static constexpr size_t RELAY_BUFFER_SIZE = 262144;
+    // paced sockets wait until they can send at least a full segment (or all of the remaining data)
+    static constexpr size_t MIN_PACED_WRITE_SIZE = 1460;
+    // compressed messages are a big-endian 32-bit header (the highest bit is set if the payload is compressed) and the payload
+    static constexpr size_t COMPRESSION_HEADER_SIZE = 4;
+    static constexpr uint32_t COMPRESSED_FLAG = 0x80000000;
+    // limits of the compressed messages, a peer sending a larger message is disconnected
+    static constexpr uint32_t MAX_COMPRESSED_MESSAGE_SIZE = 16 * 1024 * 1024;
+    static constexpr size_t MAX_DECOMPRESSED_MESSAGE_SIZE = 16 * 1024 * 1024;
+    static constexpr size_t DEFAULT_COMPRESSION_THRESHOLD = 256;
+    // writes waiting for their transmit timestamps, the oldest ones are dropped if the kernel does not report them
+    static constexpr size_t MAX_PENDING_TIMESTAMPS = 4096;
+    // limits of the buffer sizes set by the buffer tuning, the kernel doubles them for its bookkeeping
+    static constexpr int MIN_TUNED_BUFFER_SIZE = 16384;
+    static constexpr int MAX_TUNED_BUFFER_SIZE = 64 * 1024 * 1024;
+    // maximum number of buffers written with one system call
+    static constexpr size_t MAX_SEND_BUFFERS = 256;
+
+    // Immutable data that can be queued on many sockets without copying it
+    using SharedBuffer = std::shared_ptr<const std::vector<uint8_t>>;
+
+    inline SharedBuffer makeSharedBuffer(std::vector<uint8_t> data)
+    {
+        return std::make_shared<const std::vector<uint8_t>>(std::move(data));
+    }
+
+    struct SendBuffer final
+    {
+        const void* data;
+        size_t size;
+    };
 
     inline std::string ipToString(uint32_t ip)
     {
@@ -172,6 +221,517 @@ namespace cppsocket
         return result;
     }
 
+    // returns all IPv4 addresses the host name resolves to, in the order returned by the resolver
+    inline std::vector<std::pair<uint32_t, uint16_t>> getAddresses(const std::string& address)
+    {
+        std::vector<std::pair<uint32_t, uint16_t>> result;
+
+        size_t i = address.find(':');
+        std::string addressStr;
+        std::string portStr;
+
+        if (i != std::string::npos)
+        {
+            addressStr = address.substr(0, i);
+            portStr = address.substr(i + 1);
+        }
+        else
+            addressStr = address;
+
+        addrinfo hints;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+
+        addrinfo* info;
+        int ret = getaddrinfo(addressStr.c_str(), portStr.empty() ? nullptr : portStr.c_str(), &hints, &info);
+
+        if (ret != 0)
+            throw std::system_error(getLastError(), std::system_category(), "Failed to get address info of " + address);
+
+        for (addrinfo* current = info; current; current = current->ai_next)
+        {
+            sockaddr_in* addr = reinterpret_cast<sockaddr_in*>(current->ai_addr);
+            std::pair<uint32_t, uint16_t> entry(addr->sin_addr.s_addr, ntohs(addr->sin_port));
+
+            if (std::find(result.begin(), result.end(), entry) == result.end())
+                result.push_back(entry);
+        }
+
+        freeaddrinfo(info);
+
+        return result;
+    }
+
+    class SocketHandle final
+    {
+    public:
+        static constexpr uint32_t INVALID_INDEX = 0xFFFFFFFF;
+
+        SocketHandle() = default;
+        SocketHandle(uint32_t aIndex, uint32_t aGeneration):
+            index(aIndex), generation(aGeneration)
+        {
+        }
+
+        bool operator==(const SocketHandle& other) const
+        {
+            return index == other.index && generation == other.generation;
+        }
+
+        bool operator!=(const SocketHandle& other) const
+        {
+            return index != other.index || generation != other.generation;
+        }
+
+        bool isValid() const { return index != INVALID_INDEX; }
+
+        uint32_t getIndex() const { return index; }
+        uint32_t getGeneration() const { return generation; }
+
+    private:
+        uint32_t index = INVALID_INDEX;
+        uint32_t generation = 0;
+    };
+
+    // Multiple-producer single-consumer intrusive queue (Dmitry Vyukov's algorithm)
+    // push can be called from any thread, pop only from the consumer thread
+    template <class T>
+    class MpscQueue final
+    {
+    public:
+        MpscQueue():
+            head(new Node()), tail(head.load())
+        {
+        }
+
+        ~MpscQueue()
+        {
+            T value;
+            while (pop(value));
+
+            delete tail;
+        }
+
+        MpscQueue(const MpscQueue&) = delete;
+        MpscQueue& operator=(const MpscQueue&) = delete;
+
+        void push(T value)
+        {
+            Node* node = new Node(std::move(value));
+            Node* previous = head.exchange(node, std::memory_order_acq_rel);
+            previous->next.store(node, std::memory_order_release);
+        }
+
+        bool pop(T& value)
+        {
+            Node* next = tail->next.load(std::memory_order_acquire);
+            if (!next) return false;
+
+            value = std::move(next->value);
+            delete tail;
+            tail = next;
+            return true;
+        }
+
+    private:
+        struct Node final
+        {
+            Node() = default;
+            explicit Node(T&& aValue): value(std::move(aValue)) {}
+
+            std::atomic<Node*> next{nullptr};
+            T value;
+        };
+
+        std::atomic<Node*> head;
+        Node* tail;
+    };
+
+    // Wakes up a thread blocked in poll from any other thread
+    class Waker final
+    {
+    public:
+        Waker()
+        {
+#if defined(_WIN32)
+            readFd = writeFd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+            if (readFd == NULL_SOCKET)
+                throw std::system_error(WSAGetLastError(), std::system_category(), "Failed to create wakeup socket");
+
+            sockaddr_in address;
+            memset(&address, 0, sizeof(address));
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            address.sin_port = 0;
+            int addressLength = static_cast<int>(sizeof(address));
+            unsigned long mode = 1;
+
+            if (bind(readFd, reinterpret_cast<sockaddr*>(&address), addressLength) != 0 ||
+                getsockname(readFd, reinterpret_cast<sockaddr*>(&address), &addressLength) != 0 ||
+                ::connect(readFd, reinterpret_cast<sockaddr*>(&address), addressLength) != 0 ||
+                ioctlsocket(readFd, FIONBIO, &mode) != 0)
+            {
+                int error = WSAGetLastError();
+                closesocket(readFd);
+                throw std::system_error(error, std::system_category(), "Failed to set up wakeup socket");
+            }
+#elif defined(__linux__)
+            readFd = writeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (readFd == NULL_SOCKET)
+                throw std::system_error(errno, std::system_category(), "Failed to create eventfd");
+#else
+            int fds[2];
+            if (pipe(fds) != 0)
+                throw std::system_error(errno, std::system_category(), "Failed to create wakeup pipe");
+
+            readFd = fds[0];
+            writeFd = fds[1];
+
+            for (int fd : fds)
+            {
+                int flags = fcntl(fd, F_GETFL, 0);
+                if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0 ||
+                    fcntl(fd, F_SETFD, FD_CLOEXEC) != 0)
+                {
+                    int error = errno;
+                    ::close(fds[0]);
+                    ::close(fds[1]);
+                    throw std::system_error(error, std::system_category(), "Failed to set wakeup pipe flags");
+                }
+            }
+#endif
+        }
+
+        ~Waker()
+        {
+#ifdef _WIN32
+            closesocket(readFd);
+#else
+            ::close(readFd);
+            if (writeFd != readFd) ::close(writeFd);
+#endif
+        }
+
+        Waker(const Waker&) = delete;
+        Waker& operator=(const Waker&) = delete;
+
+        socket_t getFd() const { return readFd; }
+
+        void signal()
+        {
+#if defined(_WIN32)
+            char value = 0;
+            ::send(writeFd, &value, sizeof(value), 0);
+#elif defined(__linux__)
+            uint64_t value = 1;
+            while (::write(writeFd, &value, sizeof(value)) < 0 && errno == EINTR);
+#else
+            uint8_t value = 0;
+            while (::write(writeFd, &value, sizeof(value)) < 0 && errno == EINTR);
+#endif
+        }
+
+        void reset()
+        {
+#if defined(_WIN32)
+            char buffer[64];
+            while (recv(readFd, buffer, sizeof(buffer), 0) > 0);
+#elif defined(__linux__)
+            uint64_t value;
+            while (::read(readFd, &value, sizeof(value)) < 0 && errno == EINTR);
+#else
+            uint8_t buffer[64];
+            while (::read(readFd, buffer, sizeof(buffer)) > 0);
+#endif
+        }
+
+    private:
+        socket_t readFd = NULL_SOCKET;
+        socket_t writeFd = NULL_SOCKET;
+    };
+
+    // Rate limiter, rate is in bytes per second, burst is the bucket size in bytes
+    class TokenBucket final
+    {
+    public:
+        TokenBucket() = default;
+        TokenBucket(uint64_t aRate, uint64_t aBurst):
+            rate(aRate), burst(aBurst), tokens(static_cast<double>(aBurst)),
+            lastTime(std::chrono::steady_clock::now())
+        {
+        }
+
+        bool isEnabled() const { return rate != 0; }
+
+        uint64_t getRate() const { return rate; }
+        uint64_t getBurst() const { return burst; }
+
+        size_t getAvailable(std::chrono::steady_clock::time_point now)
+        {
+            tokens = std::min(tokens + std::chrono::duration<double>(now - lastTime).count() * rate,
+                              static_cast<double>(burst));
+            lastTime = now;
+
+            return static_cast<size_t>(tokens);
+        }
+
+        void consume(size_t amount)
+        {
+            tokens -= static_cast<double>(amount);
+        }
+
+        // seconds until the given amount (capped to burst) becomes available
+        float getDelay(size_t amount) const
+        {
+            double missing = static_cast<double>(std::min(static_cast<uint64_t>(amount), burst)) - tokens;
+            return (missing > 0.0) ? static_cast<float>(missing / rate) : 0.0f;
+        }
+
+    private:
+        uint64_t rate = 0;
+        uint64_t burst = 0;
+        double tokens = 0.0;
+        std::chrono::steady_clock::time_point lastTime;
+    };
+
+    // The system calls used by the sockets of a network, can be replaced to run the sockets without the kernel.
+    // The functions return the same values as the system calls and report the errors the same way
+    class Transport
+    {
+    public:
+        Transport() = default;
+        virtual ~Transport() {}
+
+        Transport(const Transport&) = delete;
+        Transport& operator=(const Transport&) = delete;
+
+        // relaying with splice or sending to the kernel directly works only on system sockets
+        virtual bool isSystem() const { return false; }
+
+        virtual socket_t createSocket() = 0;
+        virtual int closeSocket(socket_t socketFd) = 0;
+        virtual int setBlocking(socket_t socketFd, bool block) = 0;
+        virtual int setOption(socket_t socketFd, int level, int name, const void* value, socklen_t size) = 0;
+        virtual int getError(socket_t socketFd, int& error) = 0;
+        virtual int bind(socket_t socketFd, const sockaddr_in& address) = 0;
+        virtual int listen(socket_t socketFd, int queueSize) = 0;
+        virtual int connect(socket_t socketFd, const sockaddr_in& address) = 0;
+        virtual socket_t accept(socket_t socketFd, sockaddr_in& address) = 0;
+        virtual int getLocalAddress(socket_t socketFd, sockaddr_in& address) = 0;
+        virtual int64_t recv(socket_t socketFd, void* buffer, size_t size, int flags) = 0;
+        virtual int64_t send(socket_t socketFd, const void* buffer, size_t size, int flags) = 0;
+        virtual int poll(std::vector<pollfd>& pollFds, int timeout) = 0;
+
+        // Sends the buffers in order like one buffer and returns the number of bytes sent,
+        // the default implementation sends them one at a time until one is not sent completely
+        virtual int64_t sendBuffers(socket_t socketFd, const SendBuffer* buffers, size_t count, int flags)
+        {
+            int64_t total = 0;
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                const int64_t size = send(socketFd, buffers[i].data, buffers[i].size, flags);
+
+                // the error is reported by the next send if some of the data was sent
+                if (size < 0) return total ? total : size;
+
+                total += size;
+                if (static_cast<size_t>(size) < buffers[i].size) break;
+            }
+
+            return total;
+        }
+    };
+
+    class SystemTransport final: public Transport
+    {
+    public:
+        bool isSystem() const override { return true; }
+
+        socket_t createSocket() override
+        {
+            return ::socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+        }
+
+        int closeSocket(socket_t socketFd) override
+        {
+#ifdef _WIN32
+            return closesocket(socketFd);
+#else
+            return ::close(socketFd);
+#endif
+        }
+
+        int setBlocking(socket_t socketFd, bool block) override
+        {
+#ifdef _WIN32
+            unsigned long mode = block ? 0 : 1;
+            return ioctlsocket(socketFd, FIONBIO, &mode);
+#else
+            int flags = fcntl(socketFd, F_GETFL, 0);
+            if (flags < 0) return flags;
+            flags = block ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK);
+
+            return fcntl(socketFd, F_SETFL, flags);
+#endif
+        }
+
+        int setOption(socket_t socketFd, int level, int name, const void* value, socklen_t size) override
+        {
+            return setsockopt(socketFd, level, name, reinterpret_cast<const char*>(value), size);
+        }
+
+        int getError(socket_t socketFd, int& error) override
+        {
+            socklen_t errorSize = sizeof(error);
+            return getsockopt(socketFd, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&error), &errorSize);
+        }
+
+        int bind(socket_t socketFd, const sockaddr_in& address) override
+        {
+            return ::bind(socketFd, reinterpret_cast<const sockaddr*>(&address), sizeof(address));
+        }
+
+        int listen(socket_t socketFd, int queueSize) override
+        {
+            return ::listen(socketFd, queueSize);
+        }
+
+        int connect(socket_t socketFd, const sockaddr_in& address) override
+        {
+            return ::connect(socketFd, reinterpret_cast<const sockaddr*>(&address), sizeof(address));
+        }
+
+        socket_t accept(socket_t socketFd, sockaddr_in& address) override
+        {
+            socklen_t addressLength = sizeof(address);
+            return ::accept(socketFd, reinterpret_cast<sockaddr*>(&address), &addressLength);
+        }
+
+        int getLocalAddress(socket_t socketFd, sockaddr_in& address) override
+        {
+            socklen_t addressLength = sizeof(address);
+            return getsockname(socketFd, reinterpret_cast<sockaddr*>(&address), &addressLength);
+        }
+
+        int64_t recv(socket_t socketFd, void* buffer, size_t size, int flags) override
+        {
+#ifdef _WIN32
+            return ::recv(socketFd, reinterpret_cast<char*>(buffer), static_cast<int>(size), flags);
+#else
+            return ::recv(socketFd, buffer, size, flags);
+#endif
+        }
+
+        int64_t send(socket_t socketFd, const void* buffer, size_t size, int flags) override
+        {
+#ifdef _WIN32
+            return ::send(socketFd, reinterpret_cast<const char*>(buffer), static_cast<int>(size), flags);
+#else
+            return ::send(socketFd, buffer, size, flags);
+#endif
+        }
+
+#ifndef _WIN32
+        int64_t sendBuffers(socket_t socketFd, const SendBuffer* buffers, size_t count, int flags) override
+        {
+            iovec vectors[MAX_SEND_BUFFERS];
+            count = std::min(count, MAX_SEND_BUFFERS);
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                vectors[i].iov_base = const_cast<void*>(buffers[i].data);
+                vectors[i].iov_len = buffers[i].size;
+            }
+
+            msghdr message;
+            memset(&message, 0, sizeof(message));
+            message.msg_iov = vectors;
+            message.msg_iovlen = count;
+
+            return ::sendmsg(socketFd, &message, flags);
+        }
+#endif
+
+        int poll(std::vector<pollfd>& pollFds, int timeout) override
+        {
+#ifdef _WIN32
+            return WSAPoll(pollFds.data(), static_cast<ULONG>(pollFds.size()), timeout);
+#else
+            return ::poll(pollFds.data(), static_cast<nfds_t>(pollFds.size()), timeout);
+#endif
+        }
+    };
+
+    inline SystemTransport& getSystemTransport()
+    {
+        static SystemTransport transport;
+        return transport;
+    }
+
+    // Streaming compressor of a connection, the context is kept between the messages so the repeated
+    // data of the earlier messages is used to compress the later ones, both peers need the same compressor
+    class Compressor
+    {
+    public:
+        Compressor() = default;
+        virtual ~Compressor() {}
+
+        Compressor(const Compressor&) = delete;
+        Compressor& operator=(const Compressor&) = delete;
+
+        // appends the compressed data to the output, all of it has to be decompressible on its own
+        virtual void compress(const uint8_t* data, size_t size, std::vector<uint8_t>& output) = 0;
+        // appends the decompressed data to the output, throws if the data is corrupt or decompresses to more than maxSize bytes
+        virtual void decompress(const uint8_t* data, size_t size, std::vector<uint8_t>& output, size_t maxSize) = 0;
+        // called when the socket is closed, so it can be reconnected
+        virtual void reset() = 0;
+    };
+
+    struct CompressionStats final
+    {
+        uint64_t bytesSent = 0; // passed to send
+        uint64_t compressedBytesSent = 0; // written to the socket, including the headers
+        uint64_t bytesReceived = 0; // passed to the read callback
+        uint64_t compressedBytesReceived = 0; // read from the socket, including the headers
+        uint64_t uncompressedMessagesSent = 0; // smaller than the threshold
+
+        double getSendRatio() const
+        {
+            return compressedBytesSent ? static_cast<double>(bytesSent) / static_cast<double>(compressedBytesSent) : 0.0;
+        }
+
+        double getReceiveRatio() const
+        {
+            return compressedBytesReceived ? static_cast<double>(bytesReceived) / static_cast<double>(compressedBytesReceived) : 0.0;
+        }
+    };
+
+    // every timestamped socket has its own histograms, so they are coarser than the default ones:
+    // a relative error of at most 1/16 and delays up to 2^36 ns (about 69 s), about 4 KiB each
+    static constexpr uint32_t LATENCY_SUB_BUCKET_BITS = 5;
+    static constexpr uint32_t LATENCY_VALUE_BITS = 36;
+
+    // Delays in nanoseconds measured with the kernel timestamps. The receive delay is split at the poll of
+    // Network::update and the send delay at the write to the kernel, so the time spent in the kernel
+    // can be told apart from the time spent waiting for the update and the other sockets
+    struct LatencyStats final
+    {
+        Histogram receiveWaitDelay{LATENCY_SUB_BUCKET_BITS, LATENCY_VALUE_BITS}; // from the kernel receiving the data to the poll returning
+        Histogram receiveDispatchDelay{LATENCY_SUB_BUCKET_BITS, LATENCY_VALUE_BITS}; // from the poll returning to the read callback
+        Histogram sendQueueDelay{LATENCY_SUB_BUCKET_BITS, LATENCY_VALUE_BITS}; // from send to the data being written to the kernel
+        Histogram sendKernelDelay{LATENCY_SUB_BUCKET_BITS, LATENCY_VALUE_BITS}; // from the write to the kernel transmitting the data
+
+        void reset()
+        {
+            receiveWaitDelay.reset();
+            receiveDispatchDelay.reset();
+            sendQueueDelay.reset();
+            sendKernelDelay.reset();
+        }
+    };
+
     class Network;
 
     class Socket final
@@ -185,54 +745,20 @@ namespace cppsocket
         Socket& operator=(const Socket&) = delete;
 
         Socket(Socket&& other);
-        Socket& operator=(Socket&& other)
-        {
-            if (&other != this)
-            {
-                closeSocketFd();
-
-                socketFd = other.socketFd;
-                ready = other.ready;
-                blocking = other.blocking;
-                localAddress = other.localAddress;
-                localPort = other.localPort;
-                remoteAddress = other.remoteAddress;
-                remotePort = other.remotePort;
-                connectTimeout = other.connectTimeout;
-                timeSinceConnect = other.timeSinceConnect;
-                accepting = other.accepting;
-                connecting = other.connecting;
-                readCallback = std::move(other.readCallback);
-                closeCallback = std::move(other.closeCallback);
-                acceptCallback = std::move(other.acceptCallback);
-                connectCallback = std::move(other.connectCallback);
-                connectErrorCallback = std::move(other.connectErrorCallback);
-                outData = std::move(other.outData);
-
-                remoteAddressString = ipToString(remoteAddress) + ":" + std::to_string(remotePort);
-
-                other.socketFd = NULL_SOCKET;
-                other.ready = false;
-                other.blocking = true;
-                other.localAddress = 0;
-                other.localPort = 0;
-                other.remoteAddress = 0;
-                other.remotePort = 0;
-                other.accepting = false;
-                other.connecting = false;
-                other.connectTimeout = 10.0f;
-                other.timeSinceConnect = 0.0f;
-            }
-
-            return *this;
-        }
+        Socket& operator=(Socket&& other);
 
         void close()
         {
+            cancelConnectAttempts();
+
             if (socketFd != NULL_SOCKET)
             {
                 if (ready)
                 {
+                    // the errors of the last write are ignored, they must not reach the callback while closing
+                    std::function<void(Socket&, const std::error_code&)> callback;
+                    callback.swap(errorCallback);
+
                     try
                     {
                         writeData();
@@ -240,6 +766,8 @@ namespace cppsocket
                     catch (...)
                     {
                     }
+
+                    errorCallback.swap(callback);
                 }
 
                 closeSocketFd();
@@ -252,8 +780,9 @@ namespace cppsocket
             ready = false;
             accepting = false;
             connecting = false;
-            outData.clear();
-            inData.clear();
+            clearOutData();
+
+            scheduleRelease();
         }
 
         void update(float delta)
@@ -270,6 +799,10 @@ namespace cppsocket
 
                     if (connectErrorCallback)
                         connectErrorCallback(*this);
+
+                    // the connect error callback could have removed the error callback
+                    if (errorCallback)
+                        errorCallback(*this, std::make_error_code(std::errc::timed_out));
                 }
             }
         }
@@ -304,7 +837,7 @@ namespace cppsocket
             localPort = port;
             int value = 1;
 
-            if (setsockopt(socketFd, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&value), sizeof(value)) < 0)
+            if (getTransport().setOption(socketFd, SOL_SOCKET, SO_REUSEADDR, &value, sizeof(value)) < 0)
                 throw std::system_error(getLastError(), std::system_category(), "setsockopt(SO_REUSEADDR) failed");
 
             sockaddr_in serverAddress;
@@ -313,40 +846,84 @@ namespace cppsocket
             serverAddress.sin_port = htons(localPort);
             serverAddress.sin_addr.s_addr = address;
 
-            if (bind(socketFd, reinterpret_cast<sockaddr*>(&serverAddress), sizeof(serverAddress)) < 0)
+            if (getTransport().bind(socketFd, serverAddress) < 0)
                 throw std::system_error(getLastError(), std::system_category(), "Failed to bind server socket to port " + std::to_string(localPort));
 
-            if (listen(socketFd, WAITING_QUEUE_SIZE) < 0)
-                throw std::system_error(getLastError(), std::system_category(), "Failed to listen on " + ipToString(localAddress) + ":" + std::to_string(localPort));
+#ifdef TCP_FASTOPEN
+            if (fastOpenQueueSize > 0)
+            {
+                int queueSize = fastOpenQueueSize;
+                if (getTransport().setOption(socketFd, IPPROTO_TCP, TCP_FASTOPEN, &queueSize, sizeof(queueSize)) < 0)
+                {
+                    int error = getLastError();
+
+                    // Fast Open is best-effort, the server accepts normal handshakes where it is not supported
+#ifdef _WIN32
+                    if (error != WSAENOPROTOOPT &&
+                        error != WSAEOPNOTSUPP &&
+                        error != WSAEINVAL)
+#else
+                    if (error != ENOPROTOOPT &&
+                        error != EOPNOTSUPP &&
+                        error != EINVAL)
+#endif
+                        throw std::system_error(error, std::system_category(), "setsockopt(TCP_FASTOPEN) failed");
+                }
+            }
+#endif
+
+            if (getTransport().listen(socketFd, acceptQueueSize) < 0)
+                throw std::system_error(getLastError(), std::system_category(), "Failed to listen on " + ipToString(localAddress) + ":" + std::to_string(localPort));
 
             accepting = true;
             ready = true;
         }
 
+        // Connects to all the resolved addresses in parallel if there are more than one,
+        // a blocking socket tries them one after another
         void connect(const std::string& address)
         {
             ready = false;
             connecting = false;
 
-            std::pair<uint32_t, uint16_t> addr = getAddress(address);
+            std::vector<std::pair<uint32_t, uint16_t>> addresses = getAddresses(address);
 
-            connect(addr.first, addr.second);
+            if (addresses.size() == 1)
+                connect(addresses.front().first, addresses.front().second);
+            else
+                connect(addresses);
         }
 
+        // Starts connecting to the next address every connect attempt delay (or as soon as an attempt fails)
+        // until one of the attempts succeeds, the rest of the attempts are cancelled (Happy Eyeballs),
+        // a blocking socket connects to the addresses in order until one of them succeeds
+        void connect(const std::vector<std::pair<uint32_t, uint16_t>>& addresses);
+
         void connect(uint32_t address, uint16_t newPort)
         {
             ready = false;
             connecting = false;
+            fastOpenPending = false;
 
-            if (socketFd != NULL_SOCKET)
+            if (socketFd != NULL_SOCKET || !connectAttempts.empty())
                 close();
 
             createSocketFd();
 
             remoteAddress = address;
             remotePort = newPort;
+            timeSinceConnect = 0.0f;
+
+#ifdef TCP_FASTOPEN_CONNECT
+            bool fastOpenConnect = false;
 
-            remoteAddressString = ipToString(remoteAddress) + ":" + std::to_string(remotePort);
+            if (fastOpen)
+            {
+                int value = 1;
+                // not supported before Linux 4.11, the connection is opened with a normal handshake then
+                fastOpenConnect = getTransport().setOption(socketFd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &value, sizeof(value)) == 0;
+            }
+#endif
 
             sockaddr_in addr;
             memset(&addr, 0, sizeof(addr));
@@ -354,7 +931,9 @@ namespace cppsocket
             addr.sin_addr.s_addr = remoteAddress;
             addr.sin_port = htons(remotePort);
 
-            if (::connect(socketFd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) < 0)
+            bool connected = true;
+
+            if (getTransport().connect(socketFd, addr) < 0)
             {
                 int error = getLastError();
 
@@ -370,46 +949,81 @@ namespace cppsocket
                     if (connectErrorCallback)
                         connectErrorCallback(*this);
 
-                    throw std::system_error(error, std::system_category(), "Failed to connect to " + remoteAddressString);
+                    throw std::system_error(error, std::system_category(), "Failed to connect to " + getRemoteAddressString());
                 }
 
-                connecting = true;
-            }
-            else
-            {
-                // connected
-                ready = true;
-                if (connectCallback)
-                    connectCallback(*this);
+                connected = false;
             }
 
+            // the local address is read before calling the callbacks, because they can close the socket
             sockaddr_in localAddr;
-            socklen_t localAddrSize = sizeof(localAddr);
 
-            if (getsockname(socketFd, reinterpret_cast<sockaddr*>(&localAddr), &localAddrSize) != 0)
+            if (getTransport().getLocalAddress(socketFd, localAddr) != 0)
             {
                 int error = getLastError();
                 closeSocketFd();
-                connecting = false;
                 if (connectErrorCallback)
                     connectErrorCallback(*this);
-                throw std::system_error(error, std::system_category(), "Failed to get address of the socket connecting to " + remoteAddressString);
+                throw std::system_error(error, std::system_category(), "Failed to get address of the socket connecting to " + getRemoteAddressString());
             }
 
             localAddress = localAddr.sin_addr.s_addr;
             localPort = ntohs(localAddr.sin_port);
+
+#ifdef TCP_FASTOPEN_CONNECT
+            // no SYN has been sent yet, it is sent with the first write when the socket is writable,
+            // so the data sent before that goes into the SYN
+            if (fastOpenConnect && !blocking && connected)
+            {
+                fastOpenPending = true;
+                connected = false;
+            }
+#endif
+
+            if (connected)
+            {
+                ready = true;
+                if (latencyStats)
+                    setTimestampingOption();
+                if (connectCallback)
+                    connectCallback(*this);
+            }
+            else
+                connecting = true;
         }
 
         bool isConnecting() const { return connecting; }
+        bool isAccepting() const { return accepting; }
+
+        // Length of the queue of pending connections, applies to subsequent startAccept calls
+        int getAcceptQueueSize() const { return acceptQueueSize; }
+        void setAcceptQueueSize(int newAcceptQueueSize) { acceptQueueSize = newAcceptQueueSize; }
+
+        // Length of the queue of pending TCP Fast Open requests, 0 disables Fast Open on the server,
+        // applies to subsequent startAccept calls (needs net.ipv4.tcp_fastopen & 2 on Linux)
+        int getFastOpenQueueSize() const { return fastOpenQueueSize; }
+        void setFastOpenQueueSize(int newFastOpenQueueSize) { fastOpenQueueSize = newFastOpenQueueSize; }
+
+        // Sends the data sent before the next update after a non-blocking connect in the SYN of subsequent connects
+        // (needs net.ipv4.tcp_fastopen & 1 on Linux), the connect callback is still called after the handshake.
+        // The kernel falls back to a normal handshake if the server has not given a Fast Open cookie or refuses it
+        bool isFastOpen() const { return fastOpen; }
+        void setFastOpen(bool newFastOpen) { fastOpen = newFastOpen; }
 
         float getConnectTimeout() const { return connectTimeout; }
         void setConnectTimeout(float timeout) { connectTimeout = timeout; }
 
+        // Delay in seconds between the parallel connect attempts to multiple addresses
+        float getConnectAttemptDelay() const { return connectAttemptDelay; }
+        void setConnectAttemptDelay(float delay) { connectAttemptDelay = delay; }
+
         void setReadCallback(const std::function<void(Socket&, const std::vector<uint8_t>&)>& newReadCallback)
         {
             readCallback = newReadCallback;
         }
 
+        // Called when the connection is closed by the peer or fails, the socket is already closed,
+        // so the callback can connect it again
         void setCloseCallback(const std::function<void(Socket&)>& newCloseCallback)
         {
             closeCallback = newCloseCallback;
@@ -430,14 +1044,111 @@ namespace cppsocket
             connectErrorCallback = newConnectErrorCallback;
         }
 
+        // When set, the errors of reading, writing, relaying and accepting are given to the callback instead of
+        // being thrown, so the update of the network does not stop at them. The socket is closed (and the close
+        // callback called) before the callback, except for a listening socket, which stays open on accept errors.
+        // Accepted sockets inherit the callback. The errors of the calls that start something (e.g. connect) are still thrown,
+        // but a non-blocking connect that fails or times out later gives its error to the callback after the connect error callback
+        void setErrorCallback(const std::function<void(Socket&, const std::error_code&)>& newErrorCallback)
+        {
+            errorCallback = newErrorCallback;
+        }
+
+        // Can be called while connecting, the data is queued until the connection is made
         void send(std::vector<uint8_t> buffer)
         {
-            if (socketFd == NULL_SOCKET)
+            // a socket connecting to multiple addresses gets its descriptor from the attempt that succeeds
+            if (socketFd == NULL_SOCKET && !connecting)
+                throw std::runtime_error("Invalid socket");
+
+            if (compressor)
+                sendCompressed(buffer);
+            else
+                outData.insert(outData.end(), buffer.begin(), buffer.end());
+
+            // the end of the buffer in the stream of written bytes
+            if (latencyStats)
+                queuedSends.emplace_back(writtenBytes + getOutDataSize(), std::chrono::system_clock::now());
+        }
+
+        // Queues the buffer without copying it, so the same buffer can be sent on many sockets
+        // (compressing sockets copy it into their compressed stream)
+        void send(const SharedBuffer& buffer)
+        {
+            sendShared(buffer, 0);
+        }
+
+        // Queues the shared buffer like send, the tag identifies the buffers that can be conflated with replaceShared
+        void sendShared(const SharedBuffer& buffer, uint64_t tag)
+        {
+            if (socketFd == NULL_SOCKET && !connecting)
                 throw std::runtime_error("Invalid socket");
 
-            outData.insert(outData.end(), buffer.begin(), buffer.end());
+            if (!buffer || buffer->empty())
+                return;
+
+            if (compressor)
+                sendCompressed(*buffer);
+            else
+            {
+                SharedOutData entry;
+                entry.buffer = buffer;
+                entry.tag = tag;
+                entry.ownedBefore = outData.size() - outDataOffset - sharedOwnedSize;
+
+                sharedOwnedSize += entry.ownedBefore;
+                sharedOutDataSize += buffer->size();
+                sharedOutData.push_back(std::move(entry));
+            }
+
+            if (latencyStats)
+                queuedSends.emplace_back(writtenBytes + getOutDataSize(), std::chrono::system_clock::now());
+        }
+
+        // Replaces the last queued shared buffer with the tag that has not been started to be written,
+        // returns false if there is none
+        bool replaceShared(const SharedBuffer& buffer, uint64_t tag)
+        {
+            if (!buffer || buffer->empty())
+                return false;
+
+            for (auto i = sharedOutData.rbegin(); i != sharedOutData.rend(); ++i)
+            {
+                if (i->tag == tag && i->offset == 0)
+                {
+                    sharedOutDataSize = sharedOutDataSize - i->buffer->size() + buffer->size();
+                    i->buffer = buffer;
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        // Discards the data that has not been written yet, e.g. before closing a socket that can not keep up
+        void clearOutData()
+        {
+            outData.clear();
+            outDataOffset = 0;
+            sharedOutData.clear();
+            sharedOutDataSize = 0;
+            sharedOwnedSize = 0;
+        }
+
+        // Every sent buffer becomes a message that is compressed if it is at least threshold bytes long
+        // and the read callback gets whole decompressed messages, nullptr disables the compression.
+        // Should be set before anything is sent or read, on accepted sockets in the accept callback
+        void setCompressor(std::unique_ptr<Compressor> newCompressor,
+                           size_t threshold = DEFAULT_COMPRESSION_THRESHOLD)
+        {
+            compressor = std::move(newCompressor);
+            compressionThreshold = threshold;
+            clearCompressedInData();
         }
 
+        bool isCompressing() const { return compressor != nullptr; }
+        const CompressionStats& getCompressionStats() const { return compressionStats; }
+
         uint32_t getLocalAddress() const { return localAddress; }
         uint16_t getLocalPort() const { return localPort; }
 
@@ -454,7 +1165,112 @@ namespace cppsocket
         }
 
         bool isReady() const { return ready; }
-        bool hasOutData() const { return !outData.empty(); }
+        bool hasOutData() const { return !outData.empty() || !sharedOutData.empty(); }
+        size_t getOutDataSize() const { return outData.size() - outDataOffset + sharedOutDataSize; }
+
+        // Sockets with a higher priority are written first when the network has a write quantum or budget
+        int getWritePriority() const { return writePriority; }
+        void setWritePriority(int newWritePriority) { writePriority = newWritePriority; }
+
+        // accepted sockets are owned by the network and destroyed after they are closed
+        bool isPooled() const { return pooled; }
+
+        SocketHandle getHandle() const { return handle; }
+        Network& getNetwork() const { return network; }
+
+        // Passes all data read from this socket to the destination instead of the read callback,
+        // on Linux the data is moved with splice through a pipe without copying it to user space.
+        // Reading stops while the destination can not take more data, when the peer shuts down
+        // its side the write side of the destination is shut down after the buffered data is written
+        void relayTo(Socket& destination)
+        {
+            if (socketFd == NULL_SOCKET || destination.socketFd == NULL_SOCKET)
+                throw std::runtime_error("Can not relay, invalid socket");
+
+            if (&destination.network != &network)
+                throw std::runtime_error("Can not relay to a socket of another network");
+
+            if (!getTransport().isSystem())
+                throw std::runtime_error("Can not relay, the transport does not support it");
+
+#ifdef __linux__
+            if (relayPipe[0] == -1)
+            {
+                if (pipe2(relayPipe, O_NONBLOCK | O_CLOEXEC) != 0)
+                    throw std::system_error(errno, std::system_category(), "Failed to create relay pipe");
+
+                // the default pipe capacity is 64 KiB, a bigger one results in fewer system calls
+                fcntl(relayPipe[1], F_SETPIPE_SZ, static_cast<int>(RELAY_BUFFER_SIZE));
+            }
+#endif
+
+            relayTarget = destination.handle;
+            destination.relaySource = handle;
+        }
+
+        // Relays the data in both directions between this and the other socket
+        void proxy(Socket& other)
+        {
+            relayTo(other);
+            other.relayTo(*this);
+        }
+
+        bool isRelaying() const { return relayTarget.isValid(); }
+
+        uint64_t getPacingRate() const { return pacingBucket.getRate(); }
+
+        // Limits the egress of the socket to rate bytes per second (0 disables pacing),
+        // also sets the kernel pacing rate (SO_MAX_PACING_RATE) where available
+        void setPacingRate(uint64_t rate, uint64_t burst = 65536)
+        {
+            pacingBucket = (rate != 0) ? TokenBucket(rate, std::max(burst, static_cast<uint64_t>(1))) : TokenBucket();
+
+            if (socketFd != NULL_SOCKET)
+                setPacingRateOption();
+        }
+
+        bool isTimestamping() const { return latencyStats != nullptr; }
+
+        // Records the delays of the data with the kernel software timestamps (SO_TIMESTAMPING), needs
+        // Linux and the system transport. Applies once the socket is connected and to the sockets accepted
+        // by a listening socket, should be enabled before sending so the transmit timestamps match the writes
+        void setTimestamping(bool newTimestamping);
+
+        // nullptr if the socket is not timestamping
+        const LatencyStats* getLatencyStats() const { return latencyStats.get(); }
+        void resetLatencyStats() { if (latencyStats) latencyStats->reset(); }
+
+        // Time the kernel received the data passed to the current read callback,
+        // zero if the socket is not timestamping or the kernel did not timestamp the data
+        std::chrono::system_clock::time_point getReceiveTime() const { return receiveTime; }
+
+        // Sizes of the kernel send and receive buffers (SO_SNDBUF, SO_RCVBUF), 0 keeps the kernel default
+        // and its autotuning, the kernel caps them at net.core.wmem_max and net.core.rmem_max.
+        // Sockets accepted by a listening socket inherit its sizes
+        int getSendBufferSize() const { return sendBufferSize; }
+        void setSendBufferSize(int newSendBufferSize)
+        {
+            sendBufferSize = newSendBufferSize;
+
+            if (socketFd != NULL_SOCKET && sendBufferSize > 0)
+                setBufferSizeOption(SO_SNDBUF, sendBufferSize);
+        }
+
+        int getReceiveBufferSize() const { return receiveBufferSize; }
+        void setReceiveBufferSize(int newReceiveBufferSize)
+        {
+            receiveBufferSize = newReceiveBufferSize;
+
+            // should be set before connecting, the window scale is chosen for the receive buffer in the handshake
+            if (socketFd != NULL_SOCKET && receiveBufferSize > 0)
+                setBufferSizeOption(SO_RCVBUF, receiveBufferSize);
+        }
+
+        // Resizes the buffers periodically to twice the bandwidth-delay product measured from the throughput
+        // of the socket and the round-trip time of TCP_INFO, within the buffer memory budget of the network.
+        // Needs Linux and the system transport, sockets accepted by a listening socket inherit it
+        bool isBufferTuning() const { return bufferTuning; }
+        void setBufferTuning(bool newBufferTuning);
 
     private:
         Socket(Network& aNetwork, socket_t aSocketFd, bool aReady,
@@ -463,115 +1279,164 @@ namespace cppsocket
 
         void read()
         {
-            if (accepting)
+            if (connecting)
             {
-                sockaddr_in address;
-#ifdef _WIN32
-                int addressLength = static_cast<int>(sizeof(address));
-#else
-                socklen_t addressLength = sizeof(address);
-#endif
+                // a failed connect is reported as readable
+                finishConnect();
 
-                socket_t clientFd = ::accept(socketFd, reinterpret_cast<sockaddr*>(&address), &addressLength);
+                if (!ready || socketFd == NULL_SOCKET)
+                    return;
+            }
 
-                if (clientFd == NULL_SOCKET)
-                {
-                    int error = getLastError();
+            if (accepting)
+                acceptConnection();
+            else if (relayTarget.isValid())
+                relayData();
+            else
+                readData();
+        }
 
-#ifdef _WIN32
-                    if (error != WSAEWOULDBLOCK &&
-                        error != WSAEINPROGRESS)
-#else
-                    if (error != EAGAIN &&
-                        error != EWOULDBLOCK &&
-                        error != EINPROGRESS)
-#endif
-                        throw std::system_error(error, std::system_category(), "Failed to accept client");
-                }
-                else
-                {
-                    Socket socket(network, clientFd, true,
-                                  localAddress, localPort,
-                                  address.sin_addr.s_addr,
-                                  ntohs(address.sin_port));
+        void acceptConnection();
 
-                    if (acceptCallback)
-                        acceptCallback(*this, socket);
-                }
-            }
-            else
+        void finishConnect()
+        {
+#ifdef TCP_FASTOPEN_CONNECT
+            if (fastOpenPending)
             {
-                return readData();
+                sendFastOpen();
+                return;
             }
-        }
+#endif
 
-        void write()
-        {
-            if (connecting)
+            int error = 0;
+
+            if (getTransport().getError(socketFd, error) != 0)
+                error = getLastError();
+
+            if (error != 0)
+                disconnected(std::error_code(error, std::system_category())); // calls the connect error callback
+            else
             {
                 connecting = false;
                 ready = true;
+                if (latencyStats)
+                    setTimestampingOption();
                 if (connectCallback)
                     connectCallback(*this);
             }
-
-            return writeData();
         }
 
-        void readData()
+#ifdef TCP_FASTOPEN_CONNECT
+        // sends the SYN with as much of the out data as fits in it, the connection is established
+        // (or has failed) when the socket becomes writable again
+        void sendFastOpen()
         {
-#if defined(__APPLE__)
-            int flags = 0;
-#elif defined(_WIN32)
-            int flags = 0;
-#else
-            int flags = MSG_NOSIGNAL;
-#endif
+            fastOpenPending = false;
 
-#ifdef _WIN32
-            int size = recv(socketFd, reinterpret_cast<char*>(tempBuffer), sizeof(tempBuffer), flags);
-#else
-            ssize_t size = recv(socketFd, reinterpret_cast<char*>(tempBuffer), sizeof(tempBuffer), flags);
-#endif
+            const int64_t size = sharedOutData.empty() ?
+                getTransport().send(socketFd, outData.data() + outDataOffset, outData.size() - outDataOffset, MSG_NOSIGNAL) :
+                sendSharedOutData(getOutDataSize(), MSG_NOSIGNAL);
 
             if (size > 0)
             {
-                inData.assign(tempBuffer, tempBuffer + size);
-
-                if (readCallback)
-                    readCallback(*this, inData);
+                consumeOutData(static_cast<size_t>(size));
+                tuningBytesWritten += static_cast<uint64_t>(size);
             }
             else if (size < 0)
             {
-                int error = getLastError();
+                const int error = getLastError();
 
-#ifdef _WIN32
-                if (error != WSAEWOULDBLOCK &&
-                    error != WSAEINPROGRESS)
-#else
                 if (error != EAGAIN &&
                     error != EWOULDBLOCK &&
                     error != EINPROGRESS)
+                    disconnected(std::error_code(error, std::system_category())); // calls the connect error callback
+            }
+        }
 #endif
-                {
-                    disconnected();
 
-                    if (error == ECONNRESET)
-                        throw std::system_error(error, std::system_category(), "Connection to " + remoteAddressString + " reset by peer");
-                    else if (error == ECONNREFUSED)
-                        throw std::system_error(error, std::system_category(), "Connection to " + remoteAddressString + " refused");
-                    else
-                        throw std::system_error(error, std::system_category(), "Failed to read from " + remoteAddressString);
-                }
+        // returns the number of bytes written from the out data
+        size_t write(size_t maxSize = std::numeric_limits<size_t>::max())
+        {
+            if (connecting)
+                finishConnect();
+
+            const size_t size = writeData(maxSize);
+
+            if (relaySource.isValid())
+                flushRelay();
+
+            return size;
+        }
+
+        void readData();
+        // reads with the receive timestamp of the kernel
+        int64_t receiveTimestamped(int flags);
+        // reads the transmit timestamps from the error queue of the socket
+        void readTimestamps();
+        void recordReceiveDelay();
+        void recordWrite(size_t size, std::chrono::system_clock::time_point writeTime);
+        // passes the complete messages of the read data to the read callback
+        void readCompressedData(size_t size);
+
+        void sendCompressed(const std::vector<uint8_t>& buffer)
+        {
+            if (buffer.size() > MAX_DECOMPRESSED_MESSAGE_SIZE)
+                throw std::runtime_error("Message too large");
+
+            const size_t headerOffset = outData.size();
+            outData.resize(headerOffset + COMPRESSION_HEADER_SIZE);
+
+            const bool compressed = buffer.size() >= compressionThreshold;
+
+            try
+            {
+                if (compressed)
+                    compressor->compress(buffer.data(), buffer.size(), outData);
+                else
+                    outData.insert(outData.end(), buffer.begin(), buffer.end());
             }
-            else // size == 0
-                disconnected();
+            catch (...)
+            {
+                outData.resize(headerOffset);
+                throw;
+            }
+
+            const size_t size = outData.size() - headerOffset - COMPRESSION_HEADER_SIZE;
+
+            if (size > MAX_COMPRESSED_MESSAGE_SIZE)
+            {
+                outData.resize(headerOffset);
+                throw std::runtime_error("Message too large");
+            }
+
+            const uint32_t header = static_cast<uint32_t>(size) | (compressed ? COMPRESSED_FLAG : 0);
+            outData[headerOffset] = static_cast<uint8_t>(header >> 24);
+            outData[headerOffset + 1] = static_cast<uint8_t>(header >> 16);
+            outData[headerOffset + 2] = static_cast<uint8_t>(header >> 8);
+            outData[headerOffset + 3] = static_cast<uint8_t>(header);
+
+            compressionStats.bytesSent += buffer.size();
+            compressionStats.compressedBytesSent += size + COMPRESSION_HEADER_SIZE;
+            if (!compressed) ++compressionStats.uncompressedMessagesSent;
+        }
 
+        void clearCompressedInData()
+        {
+            compressedInData.clear();
+            ++compressedInDataGeneration;
         }
 
-        void writeData()
+        // reads data from the socket into the relay buffer and passes it on to the relay target
+        void relayData();
+        // writes the data relayed from the relay source
+        void flushRelay();
+        // closes the socket if it has relayed everything it will ever read and can not be written to anymore
+        void closeFinishedRelay();
+        void closeRelayPeers(SocketHandle target, SocketHandle source, bool finished);
+
+        size_t writeData(size_t maxSize = std::numeric_limits<size_t>::max())
         {
-            if (ready && !outData.empty())
+            if (ready && hasOutData() && !pacingPaused && maxSize > 0)
             {
 #if defined(__APPLE__)
                 int flags = 0;
@@ -581,13 +1446,21 @@ namespace cppsocket
                 int flags = MSG_NOSIGNAL;
 #endif
 
-#ifdef _WIN32
-                int dataSize = static_cast<int>(outData.size());
-                int size = ::send(socketFd, reinterpret_cast<const char*>(outData.data()), dataSize, flags);
-#else
-                size_t dataSize = static_cast<size_t>(outData.size());
-                ssize_t size = ::send(socketFd, reinterpret_cast<const char*>(outData.data()), dataSize, flags);
-#endif
+                size_t allowedSize = getWriteAllowance();
+
+                if (allowedSize == 0)
+                {
+                    pauseWriting();
+                    return 0;
+                }
+
+                // the kernel can transmit the data before the send returns
+                const std::chrono::system_clock::time_point writeTime =
+                    latencyStats ? std::chrono::system_clock::now() : std::chrono::system_clock::time_point();
+
+                int64_t size = sharedOutData.empty() ?
+                    getTransport().send(socketFd, outData.data() + outDataOffset, std::min(allowedSize, maxSize), flags) :
+                    sendSharedOutData(std::min(allowedSize, maxSize), flags);
 
                 if (size < 0)
                 {
@@ -601,22 +1474,133 @@ namespace cppsocket
                         error != EINPROGRESS)
 #endif
                     {
+                        if (errorCallback)
+                        {
+                            disconnected(std::error_code(error, std::system_category()));
+                            return 0;
+                        }
+
+                        const std::string address = getRemoteAddressString();
+
                         disconnected();
 
                         if (error == EPIPE)
-                            throw std::system_error(error, std::system_category(), "Failed to send data to " + remoteAddressString + ", socket has been shut down");
+                            throw std::system_error(error, std::system_category(), "Failed to send data to " + address + ", socket has been shut down");
                         else if (error == ECONNRESET)
-                            throw std::system_error(error, std::system_category(), "Connection to " + remoteAddressString + " reset by peer");
+                            throw std::system_error(error, std::system_category(), "Connection to " + address + " reset by peer");
                         else
-                            throw std::system_error(error, std::system_category(), "Failed to write to socket " + remoteAddressString);
+                            throw std::system_error(error, std::system_category(), "Failed to write to socket " + address);
                     }
                 }
 
                 if (size > 0)
-                    outData.erase(outData.begin(), outData.begin() + size);
+                {
+                    consumeWriteAllowance(static_cast<size_t>(size));
+                    consumeOutData(static_cast<size_t>(size));
+                    tuningBytesWritten += static_cast<uint64_t>(size);
+
+                    if (latencyStats)
+                        recordWrite(static_cast<size_t>(size), writeTime);
+
+                    return static_cast<size_t>(size);
+                }
+            }
+
+            return 0;
+        }
+
+        // writes the out data and the shared buffers between it with one system call
+        int64_t sendSharedOutData(size_t maxSize, int flags)
+        {
+            SendBuffer buffers[MAX_SEND_BUFFERS];
+            size_t count = 0;
+            size_t ownedOffset = outDataOffset;
+            bool complete = true;
+
+            for (const SharedOutData& entry : sharedOutData)
+            {
+                if (entry.ownedBefore > 0)
+                {
+                    if (count == MAX_SEND_BUFFERS || maxSize == 0)
+                    {
+                        complete = false;
+                        break;
+                    }
+
+                    const size_t size = std::min(entry.ownedBefore, maxSize);
+                    buffers[count++] = SendBuffer{outData.data() + ownedOffset, size};
+                    ownedOffset += size;
+                    maxSize -= size;
+                }
+
+                if (count == MAX_SEND_BUFFERS || maxSize == 0)
+                {
+                    complete = false;
+                    break;
+                }
+
+                const size_t size = std::min(entry.buffer->size() - entry.offset, maxSize);
+                buffers[count++] = SendBuffer{entry.buffer->data() + entry.offset, size};
+                maxSize -= size;
+            }
+
+            // the data sent after the last shared buffer
+            if (complete && count < MAX_SEND_BUFFERS && maxSize > 0 && ownedOffset < outData.size())
+                buffers[count++] = SendBuffer{outData.data() + ownedOffset, std::min(outData.size() - ownedOffset, maxSize)};
+
+            return getTransport().sendBuffers(socketFd, buffers, count, flags);
+        }
+
+        void consumeOutData(size_t size)
+        {
+            while (size > 0 && !sharedOutData.empty())
+            {
+                SharedOutData& entry = sharedOutData.front();
+
+                if (entry.ownedBefore > 0)
+                {
+                    const size_t ownedSize = std::min(entry.ownedBefore, size);
+                    entry.ownedBefore -= ownedSize;
+                    sharedOwnedSize -= ownedSize;
+                    outDataOffset += ownedSize;
+                    size -= ownedSize;
+                }
+                else
+                {
+                    const size_t sharedSize = std::min(entry.buffer->size() - entry.offset, size);
+                    entry.offset += sharedSize;
+                    sharedOutDataSize -= sharedSize;
+                    size -= sharedSize;
+
+                    if (entry.offset == entry.buffer->size())
+                        sharedOutData.pop_front();
+                }
+            }
+
+            outDataOffset += size;
+
+            // the written data is removed once it is at least half of the buffer,
+            // so a large backlog written in small parts is not moved on every write
+            if (outDataOffset == outData.size())
+            {
+                outData.clear();
+                outDataOffset = 0;
+            }
+            else if (outDataOffset >= outData.size() / 2)
+            {
+                outData.erase(outData.begin(), outData.begin() + static_cast<std::ptrdiff_t>(outDataOffset));
+                outDataOffset = 0;
             }
         }
 
+        // how many bytes the pacing of the socket and the network allows to write now
+        size_t getWriteAllowance();
+        void consumeWriteAllowance(size_t size);
+        // stops polling for writability until the pacing allows to write again
+        void pauseWriting();
+        // the smallest paced write, capped to the bursts so that a small bucket can still be filled
+        size_t getMinPacedWriteSize() const;
+
         void disconnected()
         {
             if (connecting)
@@ -636,25 +1620,64 @@ namespace cppsocket
                 {
                     ready = false;
 
-                    if (closeCallback)
-                        closeCallback(*this);
+                    const SocketHandle target = relayTarget;
+                    const SocketHandle source = relaySource;
+                    const bool finished = readShutdown && relaySize == 0;
 
+                    // the connection is gone before the callback, so the callback can reconnect the socket
                     if (socketFd != NULL_SOCKET)
                         closeSocketFd();
 
-                    localAddress = 0;
-                    localPort = 0;
-                    remoteAddress = 0;
-                    remotePort = 0;
-                    ready = false;
-                    outData.clear();
-                }
-            }
-        }
+                    clearOutData();
 
-        void createSocketFd()
-        {
-            socketFd = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+                    // the addresses of the closed connection are still available to the callback
+                    if (closeCallback)
+                        closeCallback(*this);
+
+                    if (socketFd == NULL_SOCKET && !connecting)
+                    {
+                        localAddress = 0;
+                        localPort = 0;
+                        remoteAddress = 0;
+                        remotePort = 0;
+
+                        scheduleRelease();
+                    }
+
+                    if (target.isValid() || source.isValid())
+                        closeRelayPeers(target, source, finished);
+                }
+            }
+        }
+
+        // closes the socket and gives the error to the error callback instead of throwing it
+        void disconnected(const std::error_code& error)
+        {
+            disconnected();
+
+            // the close callback could have removed the error callback
+            if (errorCallback)
+                errorCallback(*this, error);
+        }
+
+        // pooled sockets are destroyed by the network at the end of the update
+        void scheduleRelease();
+
+        Transport& getTransport() const;
+
+        void startConnectAttempt();
+        void connectAttemptSucceeded(Socket& attempt);
+        void connectAttemptFailed(Socket& attempt);
+        void cancelConnectAttempts();
+
+        std::string getRemoteAddressString() const
+        {
+            return ipToString(remoteAddress) + ":" + std::to_string(remotePort);
+        }
+
+        void createSocketFd()
+        {
+            socketFd = getTransport().createSocket();
 
             if (socketFd == NULL_SOCKET)
                 throw std::system_error(getLastError(), std::system_category(), "Failed to create socket");
@@ -664,22 +1687,109 @@ namespace cppsocket
 
 #ifdef __APPLE__
             int set = 1;
-            if (setsockopt(socketFd, SOL_SOCKET, SO_NOSIGPIPE, &set, sizeof(int)) != 0)
+            if (getTransport().setOption(socketFd, SOL_SOCKET, SO_NOSIGPIPE, &set, sizeof(int)) != 0)
                 throw std::system_error(errno, std::system_category(), "Failed to set socket option");
 #endif
+
+            setSocketOptions();
+
+            if (pacingBucket.isEnabled())
+                setPacingRateOption();
+
+            if (sendBufferSize > 0)
+                setBufferSizeOption(SO_SNDBUF, sendBufferSize);
+
+            if (receiveBufferSize > 0)
+                setBufferSizeOption(SO_RCVBUF, receiveBufferSize);
+        }
+
+        // applies the options configured on the network to the socket
+        void setSocketOptions();
+
+        void setPacingRateOption()
+        {
+#ifdef SO_MAX_PACING_RATE
+            // ~0U means unlimited
+            unsigned int value = (pacingBucket.isEnabled() && pacingBucket.getRate() < ~0U) ?
+                static_cast<unsigned int>(pacingBucket.getRate()) : ~0U;
+
+            if (getTransport().setOption(socketFd, SOL_SOCKET, SO_MAX_PACING_RATE, &value, sizeof(value)) != 0)
+                throw std::system_error(errno, std::system_category(), "setsockopt(SO_MAX_PACING_RATE) failed");
+#endif
+        }
+
+        void setBufferSizeOption(int name, int size)
+        {
+            if (getTransport().setOption(socketFd, SOL_SOCKET, name, &size, sizeof(size)) != 0)
+                throw std::system_error(getLastError(), std::system_category(),
+                                        (name == SO_SNDBUF) ? "setsockopt(SO_SNDBUF) failed" : "setsockopt(SO_RCVBUF) failed");
+        }
+
+        // returns false if the socket has not been measured long enough
+        bool getBufferTargets(std::chrono::steady_clock::time_point currentTime, uint64_t& sendTarget, uint64_t& receiveTarget);
+        void resizeBuffers(int newSendBufferSize, int newReceiveBufferSize);
+
+        void setTimestampingOption()
+        {
+#ifdef __linux__
+            // the transmit timestamps carry no data (OPT_TSONLY) and are matched to the writes
+            // by the offset of the last byte in the stream (OPT_ID), which starts from zero here
+            int value = latencyStats ? (SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_TX_SOFTWARE |
+                                        SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_ID |
+                                        SOF_TIMESTAMPING_OPT_TSONLY) : 0;
+
+            if (getTransport().setOption(socketFd, SOL_SOCKET, SO_TIMESTAMPING, &value, sizeof(value)) != 0)
+                throw std::system_error(errno, std::system_category(), "setsockopt(SO_TIMESTAMPING) failed");
+
+            timestampKey = 0;
+            pendingWrites.clear();
+#endif
+        }
+
+        static uint64_t getNanoseconds(std::chrono::system_clock::duration duration)
+        {
+            // the clock can be adjusted between the timestamps
+            return (duration.count() > 0) ?
+                static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count()) : 0;
         }
 
         void closeSocketFd()
         {
             if (socketFd != NULL_SOCKET)
             {
-#ifdef _WIN32
-                closesocket(socketFd);
-#else
-                ::close(socketFd);
-#endif
+                getTransport().closeSocket(socketFd);
                 socketFd = NULL_SOCKET;
             }
+
+            closeRelay();
+
+            if (compressor)
+            {
+                compressor->reset();
+                clearCompressedInData();
+            }
+
+            queuedSends.clear();
+            pendingWrites.clear();
+        }
+
+        void closeRelay()
+        {
+#ifdef __linux__
+            if (relayPipe[0] != -1)
+            {
+                ::close(relayPipe[0]);
+                ::close(relayPipe[1]);
+                relayPipe[0] = relayPipe[1] = -1;
+            }
+#else
+            relayBuffer.clear();
+#endif
+            relayTarget = SocketHandle();
+            relaySource = SocketHandle();
+            relaySize = 0;
+            readShutdown = false;
+            writeShutdown = false;
         }
 
         void setFdBlocking(bool block)
@@ -687,22 +1797,12 @@ namespace cppsocket
             if (socketFd == NULL_SOCKET)
                 throw std::runtime_error("Invalid socket");
 
-#ifdef _WIN32
-            unsigned long mode = block ? 0 : 1;
-            if (ioctlsocket(socketFd, FIONBIO, &mode) != 0)
-                throw std::system_error(WSAGetLastError(), std::system_category(), "Failed to set socket mode");
-#else
-            int flags = fcntl(socketFd, F_GETFL, 0);
-            if (flags < 0)
-                throw std::system_error(errno, std::system_category(), "Failed to get socket flags");
-            flags = block ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK);
-
-            if (fcntl(socketFd, F_SETFL, flags) != 0)
-                throw std::system_error(errno, std::system_category(), "Failed to set socket flags");
-#endif
+            if (getTransport().setBlocking(socketFd, block) != 0)
+                throw std::system_error(getLastError(), std::system_category(), "Failed to set socket mode");
         }
 
         Network& network;
+        SocketHandle handle;
 
         socket_t socketFd = NULL_SOCKET;
 
@@ -717,216 +1817,1876 @@ namespace cppsocket
 
         float connectTimeout = 10.0f;
         float timeSinceConnect = 0.0f;
+        float connectAttemptDelay = 0.25f;
+        std::vector<std::pair<uint32_t, uint16_t>> connectAddresses;
+        size_t nextConnectAddress = 0;
+        std::vector<SocketHandle> connectAttempts;
+        uint64_t connectAttemptTimer = 0;
         bool accepting = false;
         bool connecting = false;
+        int acceptQueueSize = WAITING_QUEUE_SIZE;
+        int fastOpenQueueSize = 0;
+        bool fastOpen = false;
+        bool fastOpenPending = false; // the SYN has not been sent yet, it goes out with the first write
+
+        TokenBucket pacingBucket;
+        bool pacingPaused = false;
+
+        std::unique_ptr<Compressor> compressor;
+        size_t compressionThreshold = DEFAULT_COMPRESSION_THRESHOLD;
+        std::vector<uint8_t> compressedInData; // incomplete message
+        uint64_t compressedInDataGeneration = 0; // changes when the compressed data is discarded
+        CompressionStats compressionStats;
+
+        int sendBufferSize = 0;
+        int receiveBufferSize = 0;
+        bool bufferTuning = false;
+        uint64_t tuningBytesWritten = 0; // since the last tuning
+        uint64_t tuningBytesRead = 0;
+        bool receiveBufferLimited = false; // since the last tuning
+        std::chrono::steady_clock::time_point bufferTuningTime;
+
+        std::unique_ptr<LatencyStats> latencyStats;
+        std::chrono::system_clock::time_point receiveTime;
+        uint64_t writtenBytes = 0;
+        uint32_t timestampKey = 0; // offset of the next written byte since the timestamping was enabled
+        std::deque<std::pair<uint64_t, std::chrono::system_clock::time_point>> queuedSends; // end in the written bytes and time of send
+        std::deque<std::pair<uint32_t, std::chrono::system_clock::time_point>> pendingWrites; // key of the last byte and time of the write
+
+        SocketHandle relayTarget;
+        SocketHandle relaySource;
+#ifdef __linux__
+        int relayPipe[2] = {-1, -1};
+#else
+        std::vector<uint8_t> relayBuffer;
+#endif
+        size_t relaySize = 0; // bytes read but not yet written to the relay target
+        bool readShutdown = false;
+        bool writeShutdown = false;
 
         std::function<void(Socket&, const std::vector<uint8_t>&)> readCallback;
         std::function<void(Socket&)> closeCallback;
         std::function<void(Socket&, Socket&)> acceptCallback;
         std::function<void(Socket&)> connectCallback;
         std::function<void(Socket&)> connectErrorCallback;
+        std::function<void(Socket&, const std::error_code&)> errorCallback;
 
-        std::vector<uint8_t> inData;
-        std::vector<uint8_t> outData;
-
-        std::string remoteAddressString;
+        struct SharedOutData final
+        {
+            SharedBuffer buffer;
+            size_t offset = 0; // already written
+            size_t ownedBefore = 0; // bytes of the out data sent between the previous shared buffer and this one
+            uint64_t tag = 0;
+        };
 
-        uint8_t tempBuffer[1024];
+        std::vector<uint8_t> outData;
+        size_t outDataOffset = 0; // already written
+        std::deque<SharedOutData> sharedOutData;
+        size_t sharedOutDataSize = 0; // not yet written
+        size_t sharedOwnedSize = 0; // bytes of the out data that go before the last shared buffer
+        int writePriority = 0;
+        uint64_t lastWriteUpdate = 0; // the update in which the scheduler last wrote the socket
+
+        bool pooled = false;
+        bool releasePending = false;
     };
 
     class Network final
     {
         friend Socket;
     public:
-        Network()
+        Network():
+            Network(getSystemTransport())
+        {
+        }
+
+        // all sockets of the network use the transport, it has to outlive the network
+        explicit Network(Transport& aTransport):
+            transport(aTransport)
         {
             previousTime = std::chrono::steady_clock::now();
         }
 
-        void update()
+        ~Network()
         {
-            for (Socket* socket : socketDeleteSet)
-            {
-                auto i = std::find(sockets.begin(), sockets.end(), socket);
+            releasedSockets.clear();
 
-                if (i != sockets.end())
-                    sockets.erase(i);
-            }
+            for (Slot& slot : slots)
+                if (slot.socket && slot.socket->pooled)
+                    destroyPooledSocket(slot.socket);
+        }
 
-            socketDeleteSet.clear();
+        Network(const Network&) = delete;
+        Network& operator=(const Network&) = delete;
 
-            for (Socket* socket : socketAddSet)
-            {
-                auto i = std::find(sockets.begin(), sockets.end(), socket);
+        // Can be called from any thread, the task is executed on the thread calling update
+        void post(std::function<void()> task)
+        {
+            tasks.push(std::move(task));
 
-                if (i == sockets.end())
-                    sockets.push_back(socket);
-            }
+            if (!wakeupPending.exchange(true))
+                waker.signal();
+        }
+
+        // Can be called from any thread, the data is dropped if the socket no longer exists
+        void sendFromAnyThread(SocketHandle handle, std::vector<uint8_t> buffer)
+        {
+            post(std::bind(&Network::sendToHandle, this, handle, std::move(buffer)));
+        }
+
+        Transport& getTransport() const { return transport; }
+
+        // Returns nullptr if the socket has been destroyed, can be called only from the thread calling update
+        Socket* getSocket(SocketHandle handle) const
+        {
+            if (handle.getIndex() >= slots.size()) return nullptr;
+
+            const Slot& slot = slots[handle.getIndex()];
+            return (slot.generation == handle.getGeneration()) ? slot.socket : nullptr;
+        }
+
+        // Time in seconds to keep polling without blocking before update waits for events
+        float getSpinTime() const { return spinTime; }
+        void setSpinTime(float newSpinTime) { spinTime = newSpinTime; }
 
-            socketAddSet.clear();
+        // Time in microseconds the kernel busy polls the device queue on reads (SO_BUSY_POLL),
+        // applies to sockets created or accepted after the call
+        uint32_t getBusyPollTime() const { return busyPollTime; }
+        void setBusyPollTime(uint32_t newBusyPollTime) { busyPollTime = newBusyPollTime; }
+
+        // Pins the calling thread (the one that should call update) to the given CPU core
+        static void setThreadAffinity(uint32_t cpu)
+        {
+#if defined(_WIN32)
+            if (!SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(1) << cpu))
+                throw std::system_error(GetLastError(), std::system_category(), "Failed to set thread affinity");
+#elif defined(__linux__)
+            cpu_set_t cpuSet;
+            CPU_ZERO(&cpuSet);
+            CPU_SET(cpu, &cpuSet);
+
+            if (sched_setaffinity(0, sizeof(cpuSet), &cpuSet) != 0)
+                throw std::system_error(errno, std::system_category(), "Failed to set thread affinity");
+#else
+            (void)cpu;
+            throw std::runtime_error("Thread affinity is not supported on this platform");
+#endif
+        }
 
+        // timeout is in seconds, negative timeout blocks until there are events or tasks
+        void update(float timeout = 0.0f)
+        {
             auto currentTime = std::chrono::steady_clock::now();
             auto diff = std::chrono::duration_cast<std::chrono::microseconds>(currentTime - previousTime);
 
-            float delta = diff.count() / 1000000000.0f;
+            float delta = diff.count() / 1000000.0f;
             previousTime = currentTime;
 
-            std::vector<pollfd> pollFds;
-            pollFds.reserve(sockets.size());
+            pollFds.clear();
+            pollHandles.clear();
 
-            for (auto socket : sockets)
+            pollfd wakeupPollFd;
+            wakeupPollFd.fd = waker.getFd();
+            wakeupPollFd.events = POLLIN;
+            pollFds.push_back(wakeupPollFd);
+            pollHandles.push_back(SocketHandle());
+
+            for (uint32_t index = 0; index < slots.size(); ++index)
             {
-                if (socket->socketFd != NULL_SOCKET)
+                Socket* socket = slots[index].socket;
+
+                if (socket && socket->socketFd != NULL_SOCKET)
                 {
                     pollfd pollFd;
                     pollFd.fd = socket->socketFd;
-                    pollFd.events = POLLIN | POLLOUT;
+                    // only wait for writability when there is something to write,
+                    // otherwise a blocking poll would return immediately
+                    pollFd.events = 0;
+                    if (!socket->relayTarget.isValid() ||
+                        (!socket->readShutdown && socket->relaySize == 0)) // relay back-pressure
+                        pollFd.events |= POLLIN;
+
+                    if (socket->connecting || (socket->hasOutData() && !socket->pacingPaused))
+                        pollFd.events |= POLLOUT;
+                    else if (!socket->hasOutData() && socket->relaySource.isValid())
+                    {
+                        Socket* source = getSocket(socket->relaySource);
+                        if (source && source->relaySize > 0)
+                            pollFd.events |= POLLOUT;
+                    }
 
                     pollFds.push_back(pollFd);
+                    pollHandles.push_back(SocketHandle(index, slots[index].generation));
                 }
             }
 
-            if (!pollFds.empty())
+            removeCancelledTimers();
+
+            if (!timers.empty())
             {
-#ifdef _WIN32
-                if (WSAPoll(pollFds.data(), static_cast<ULONG>(pollFds.size()), 0) < 0)
-                    throw std::system_error(WSAGetLastError(), std::system_category(), "Poll failed");
-#else
-                if (poll(pollFds.data(), static_cast<nfds_t>(pollFds.size()), 0) < 0)
-                    throw std::system_error(errno, std::system_category(), "Poll failed");
-#endif
+                float timerTimeout = std::max(std::chrono::duration<float>(timers.front().time - currentTime).count(), 0.0f);
+                if (timeout < 0.0f || timerTimeout < timeout) timeout = timerTimeout;
+            }
+
+            bool ready = false;
 
+            if (timeout != 0.0f && spinTime > 0.0f)
+            {
+                auto spinStart = std::chrono::steady_clock::now();
+                float spinDuration = (timeout < 0.0f) ? spinTime : std::min(spinTime, timeout);
 
-                for (pollfd& pollFd : pollFds)
+                for (;;)
                 {
-                    for (Socket* deleteSocket : socketDeleteSet)
+                    if (poll(pollFds, 0) > 0)
                     {
-                        auto i = std::find(sockets.begin(), sockets.end(), deleteSocket);
+                        ready = true;
+                        break;
+                    }
 
-                        if (i != sockets.end())
-                            sockets.erase(i);
+                    float spent = std::chrono::duration<float>(std::chrono::steady_clock::now() - spinStart).count();
+
+                    if (spent >= spinDuration)
+                    {
+                        if (timeout > 0.0f) timeout = std::max(timeout - spent, 0.0f);
+                        break;
                     }
+                }
+            }
 
-                    socketDeleteSet.clear();
+            if (!ready)
+                poll(pollFds, (timeout < 0.0f) ? -1 : static_cast<int>(std::ceil(timeout * 1000.0f)));
 
-                    auto i = std::find_if(sockets.begin(), sockets.end(), [&pollFd](Socket* socket) {
-                        return socket->socketFd == pollFd.fd;
-                    });
+            // the kernel timestamps are in the realtime clock
+            pollTime = std::chrono::system_clock::now();
 
-                    if (i != sockets.end())
-                    {
-                        Socket* socket = *i;
+            if (pollFds[0].revents & POLLIN)
+                runTasks();
+
+            for (size_t i = 1; i < pollFds.size(); ++i)
+            {
+                const pollfd& pollFd = pollFds[i];
 
-                        if (pollFd.revents & POLLIN)
-                            socket->read();
+                // the socket could have been destroyed or reconnected by a callback
+                Socket* socket = getSocket(pollHandles[i]);
 
-                        if (pollFd.revents & POLLOUT)
-                            socket->write();
+                if (socket && socket->socketFd == pollFd.fd)
+                {
+                    // the transmit timestamps are queued as errors
+                    if ((pollFd.revents & POLLERR) && socket->latencyStats && socket->ready)
+                        socket->readTimestamps();
+
+                    if (pollFd.revents & POLLIN)
+                        socket->read();
 
-                        socket->update(delta);
+                    if (pollFd.revents & POLLOUT)
+                    {
+                        if (writeQuantum || writeBudget)
+                            writableSockets.push_back(pollHandles[i]);
+                        else
+                            socket->write();
                     }
+
+                    socket->update(delta);
                 }
             }
+
+            if (!writableSockets.empty())
+                writeSockets();
+
+            if (currentTime >= nextBufferTuningTime)
+            {
+                nextBufferTuningTime = currentTime +
+                    std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(bufferTuningInterval));
+                tuneBuffers(currentTime);
+            }
+
+            runTimers();
+            releaseSockets();
+        }
+
+        // Maximum number of bytes written to a socket in one update, 0 means no limit,
+        // so one socket with a large backlog can not delay the others
+        size_t getWriteQuantum() const { return writeQuantum; }
+        void setWriteQuantum(size_t newWriteQuantum) { writeQuantum = newWriteQuantum; }
+
+        // Maximum number of bytes written to all sockets in one update, 0 means no limit,
+        // the sockets that did not get to write are written first in the next update
+        size_t getWriteBudget() const { return writeBudget; }
+        void setWriteBudget(size_t newWriteBudget) { writeBudget = newWriteBudget; }
+
+        // Time in seconds between the resizes of the buffers of the sockets with buffer tuning
+        float getBufferTuningInterval() const { return bufferTuningInterval; }
+        void setBufferTuningInterval(float newBufferTuningInterval) { bufferTuningInterval = newBufferTuningInterval; }
+
+        // Maximum total size of the send and receive buffers of the sockets with buffer tuning, 0 means no limit,
+        // the buffers are shrunk proportionally when their targets exceed it (but not below MIN_TUNED_BUFFER_SIZE)
+        uint64_t getBufferMemoryBudget() const { return bufferMemoryBudget; }
+        void setBufferMemoryBudget(uint64_t newBufferMemoryBudget) { bufferMemoryBudget = newBufferMemoryBudget; }
+
+        // Total size of the buffers set by the last tuning
+        uint64_t getBufferMemory() const { return bufferMemory; }
+
+        using TimerId = uint64_t;
+
+        // Calls the callback once after delay seconds from update, can be called only from the thread calling update
+        TimerId addTimer(float delay, std::function<void()> callback)
+        {
+            Timer timer;
+            timer.time = std::chrono::steady_clock::now() +
+                std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(delay));
+            timer.id = ++lastTimerId;
+            timer.callback = std::move(callback);
+
+            timers.push_back(std::move(timer));
+            std::push_heap(timers.begin(), timers.end(), Timer::compare);
+            activeTimers.insert(lastTimerId);
+
+            return lastTimerId;
+        }
+
+        void cancelTimer(TimerId timerId)
+        {
+            if (activeTimers.erase(timerId) == 0)
+                return;
+
+            // the cancelled timers stay in the heap until they reach the top,
+            // unless they are the majority, then the heap is rebuilt without them
+            if (timers.size() > 2 * activeTimers.size())
+            {
+                timers.erase(std::remove_if(timers.begin(), timers.end(), [this](const Timer& timer) {
+                    return activeTimers.find(timer.id) == activeTimers.end();
+                }), timers.end());
+                std::make_heap(timers.begin(), timers.end(), Timer::compare);
+            }
+            else
+                removeCancelledTimers();
+        }
+
+        uint64_t getPacingRate() const { return pacingBucket.getRate(); }
+
+        // Limits the total egress of all sockets to rate bytes per second (0 disables pacing)
+        void setPacingRate(uint64_t rate, uint64_t burst = 65536)
+        {
+            pacingBucket = (rate != 0) ? TokenBucket(rate, std::max(burst, static_cast<uint64_t>(1))) : TokenBucket();
         }
 
     private:
-        void addSocket(Socket& socket)
+        struct Slot final
+        {
+            Socket* socket = nullptr;
+            uint32_t generation = 0;
+        };
+
+        struct BufferTarget final
+        {
+            Socket* socket = nullptr;
+            uint64_t sendSize = 0;
+            uint64_t receiveSize = 0;
+        };
+
+        struct Timer final
+        {
+            static bool compare(const Timer& a, const Timer& b)
+            {
+                return a.time > b.time;
+            }
+
+            std::chrono::steady_clock::time_point time;
+            TimerId id;
+            std::function<void()> callback;
+        };
+
+        // pops the cancelled timers off the top of the heap, so that they do not limit the poll timeout
+        void removeCancelledTimers()
         {
-            socketAddSet.insert(&socket);
+            while (!timers.empty() && activeTimers.find(timers.front().id) == activeTimers.end())
+            {
+                std::pop_heap(timers.begin(), timers.end(), Timer::compare);
+                timers.pop_back();
+            }
+        }
+
+        void runTimers()
+        {
+            auto currentTime = std::chrono::steady_clock::now();
+
+            while (!timers.empty() && timers.front().time <= currentTime)
+            {
+                std::pop_heap(timers.begin(), timers.end(), Timer::compare);
+                Timer timer = std::move(timers.back());
+                timers.pop_back();
+
+                auto i = activeTimers.find(timer.id);
+                if (i != activeTimers.end())
+                {
+                    activeTimers.erase(i);
+                    timer.callback();
+                }
+            }
+        }
+
+        SocketHandle createHandle(Socket& socket)
+        {
+            uint32_t index;
+
+            if (freeSlots.empty())
+            {
+                index = static_cast<uint32_t>(slots.size());
+                slots.push_back(Slot());
+            }
+            else
+            {
+                index = freeSlots.back();
+                freeSlots.pop_back();
+            }
+
+            slots[index].socket = &socket;
+            return SocketHandle(index, slots[index].generation);
+        }
+
+        void destroyHandle(SocketHandle handle)
+        {
+            if (!handle.isValid()) return;
 
-            auto setIterator = socketDeleteSet.find(&socket);
+            Slot& slot = slots[handle.getIndex()];
+            slot.socket = nullptr;
+            ++slot.generation;
+            freeSlots.push_back(handle.getIndex());
+        }
 
-            if (setIterator != socketDeleteSet.end())
-                socketDeleteSet.erase(setIterator);
+        // points the handle of the socket to its new location after a move
+        void moveHandle(Socket& socket)
+        {
+            slots[socket.handle.getIndex()].socket = &socket;
         }
 
-        void removeSocket(Socket& socket)
+        // the first socket takes over the connection of the second one,
+        // handles to the previous connection of the first socket become invalid
+        void swapHandles(Socket& first, Socket& second)
         {
-            socketDeleteSet.insert(&socket);
+            Slot& firstSlot = slots[first.handle.getIndex()];
+            ++firstSlot.generation;
+            firstSlot.socket = &second;
 
-            auto setIterator = socketAddSet.find(&socket);
+            std::swap(first.handle, second.handle);
+            second.handle = SocketHandle(second.handle.getIndex(), firstSlot.generation);
 
-            if (setIterator != socketAddSet.end())
-                socketAddSet.erase(setIterator);
+            moveHandle(first);
         }
 
+        int poll(std::vector<pollfd>& pollFds, int timeout)
+        {
 #ifdef _WIN32
-        WinSock winSock;
+            int result = transport.poll(pollFds, timeout);
+            if (result < 0)
+                throw std::system_error(WSAGetLastError(), std::system_category(), "Poll failed");
+#else
+            int result = transport.poll(pollFds, timeout);
+            if (result < 0)
+            {
+                if (errno != EINTR)
+                    throw std::system_error(errno, std::system_category(), "Poll failed");
+
+                for (pollfd& pollFd : pollFds) pollFd.revents = 0;
+            }
 #endif
+            return result;
+        }
 
-        std::vector<Socket*> sockets;
-        std::set<Socket*> socketAddSet;
-        std::set<Socket*> socketDeleteSet;
+        // resizes the buffers of the tuned sockets towards their targets, scaled down to fit the budget
+        void tuneBuffers(std::chrono::steady_clock::time_point currentTime)
+        {
+            bufferTargets.clear();
+            uint64_t total = 0;
 
-        std::chrono::steady_clock::time_point previousTime;
-    };
+            for (const Slot& slot : slots)
+            {
+                Socket* socket = slot.socket;
+                BufferTarget target;
 
-    Socket::Socket(Network& aNetwork):
-        network(aNetwork)
-    {
-        network.addSocket(*this);
-    }
+                if (socket && socket->bufferTuning && socket->ready && !socket->accepting &&
+                    socket->socketFd != NULL_SOCKET &&
+                    socket->getBufferTargets(currentTime, target.sendSize, target.receiveSize))
+                {
+                    target.socket = socket;
+                    bufferTargets.push_back(target);
+                    total += target.sendSize + target.receiveSize;
+                }
+            }
 
-    Socket::~Socket()
-    {
-        network.removeSocket(*this);
+            const double scale = (bufferMemoryBudget && total > bufferMemoryBudget) ?
+                static_cast<double>(bufferMemoryBudget) / static_cast<double>(total) : 1.0;
 
-        try
-        {
-            writeData();
+            bufferMemory = 0;
+
+            for (const BufferTarget& target : bufferTargets)
+            {
+                const int sendSize = std::max(static_cast<int>(target.sendSize * scale), MIN_TUNED_BUFFER_SIZE);
+                const int receiveSize = std::max(static_cast<int>(target.receiveSize * scale), MIN_TUNED_BUFFER_SIZE);
+
+                target.socket->resizeBuffers(sendSize, receiveSize);
+                bufferMemory += static_cast<uint64_t>(target.socket->sendBufferSize) +
+                    static_cast<uint64_t>(target.socket->receiveBufferSize);
+            }
         }
-        catch (...)
+
+        void sendToHandle(SocketHandle handle, std::vector<uint8_t>& buffer)
         {
+            if (Socket* socket = getSocket(handle))
+                if (socket->socketFd != NULL_SOCKET)
+                    socket->send(std::move(buffer));
         }
 
-        closeSocketFd();
-    }
+        // writes the sockets by priority and then the ones that have waited the longest first
+        void writeSockets()
+        {
+            ++writeUpdate;
 
-    Socket::Socket(Socket&& other):
-        network(other.network),
-        socketFd(other.socketFd),
-        ready(other.ready),
-        blocking(other.blocking),
-        localAddress(other.localAddress),
-        localPort(other.localPort),
-        remoteAddress(other.remoteAddress),
-        remotePort(other.remotePort),
-        connectTimeout(other.connectTimeout),
-        timeSinceConnect(other.timeSinceConnect),
-        accepting(other.accepting),
-        connecting(other.connecting),
-        readCallback(std::move(other.readCallback)),
-        closeCallback(std::move(other.closeCallback)),
-        acceptCallback(std::move(other.acceptCallback)),
-        connectCallback(std::move(other.connectCallback)),
-        connectErrorCallback(std::move(other.connectErrorCallback)),
-        outData(std::move(other.outData))
-    {
-        network.addSocket(*this);
+            writableSockets.erase(std::remove_if(writableSockets.begin(), writableSockets.end(), [this](SocketHandle socketHandle) {
+                return getSocket(socketHandle) == nullptr;
+            }), writableSockets.end());
 
-        remoteAddressString = ipToString(remoteAddress) + ":" + std::to_string(remotePort);
+            std::sort(writableSockets.begin(), writableSockets.end(), [this](SocketHandle first, SocketHandle second) {
+                const Socket* firstSocket = getSocket(first);
+                const Socket* secondSocket = getSocket(second);
 
-        other.socketFd = NULL_SOCKET;
-        other.ready = false;
-        other.blocking = true;
-        other.localAddress = 0;
-        other.localPort = 0;
-        other.remoteAddress = 0;
-        other.remotePort = 0;
-        other.connecting = false;
-        other.connectTimeout = 10.0f;
-        other.timeSinceConnect = 0.0f;
-    }
+                if (firstSocket->writePriority != secondSocket->writePriority)
+                    return firstSocket->writePriority > secondSocket->writePriority;
 
-    Socket::Socket(Network& aNetwork, socket_t aSocketFd, bool aReady,
-           uint32_t aLocalAddress, uint16_t aLocalPort,
-           uint32_t aRemoteAddress, uint16_t aRemotePort):
-        network(aNetwork), socketFd(aSocketFd), ready(aReady),
-        localAddress(aLocalAddress), localPort(aLocalPort),
-        remoteAddress(aRemoteAddress), remotePort(aRemotePort)
-    {
-        remoteAddressString = ipToString(remoteAddress) + ":" + std::to_string(remotePort);
-        network.addSocket(*this);
+                return firstSocket->lastWriteUpdate < secondSocket->lastWriteUpdate;
+            });
+
+            size_t budget = writeBudget ? writeBudget : std::numeric_limits<size_t>::max();
+
+            for (SocketHandle socketHandle : writableSockets)
+            {
+                if (budget == 0) break;
+
+                // the socket could have been destroyed by a callback of another socket
+                Socket* socket = getSocket(socketHandle);
+                if (!socket || socket->socketFd == NULL_SOCKET) continue;
+
+                socket->lastWriteUpdate = writeUpdate;
+                const size_t size = socket->write(writeQuantum ? std::min(writeQuantum, budget) : budget);
+
+                if (writeBudget) budget -= size;
+            }
+
+            writableSockets.clear();
+        }
+
+        void runTasks()
+        {
+            waker.reset();
+            wakeupPending.store(false);
+
+            std::function<void()> task;
+            while (tasks.pop(task))
+                task();
+        }
+
+        Socket& createPooledSocket()
+        {
+            return createPooledSocket(NULL_SOCKET, 0, 0, 0, 0);
+        }
+
+        Socket& createPooledSocket(socket_t socketFd,
+                                   uint32_t localAddress, uint16_t localPort,
+                                   uint32_t remoteAddress, uint16_t remotePort)
+        {
+            if (freePoolEntries.empty())
+            {
+                poolChunks.push_back(std::unique_ptr<PoolChunk>(new PoolChunk()));
+
+                for (PoolEntry& entry : poolChunks.back()->entries)
+                    freePoolEntries.push_back(&entry);
+            }
+
+            PoolEntry* entry = freePoolEntries.back();
+            freePoolEntries.pop_back();
+
+            Socket* socket;
+
+            try
+            {
+                socket = new (entry) Socket(*this, socketFd, true,
+                                            localAddress, localPort,
+                                            remoteAddress, remotePort);
+            }
+            catch (...)
+            {
+                freePoolEntries.push_back(entry);
+                throw;
+            }
+
+            socket->pooled = true;
+            return *socket;
+        }
+
+        void destroyPooledSocket(Socket* socket)
+        {
+            socket->~Socket();
+            freePoolEntries.push_back(reinterpret_cast<PoolEntry*>(socket));
+        }
+
+        void releaseSockets()
+        {
+            // callbacks of the destroyed sockets can release more sockets
+            for (size_t i = 0; i < releasedSockets.size(); ++i)
+            {
+                Socket* socket = releasedSockets[i];
+                socket->releasePending = false;
+
+                // the socket could have been reused by its close callback
+                if (socket->socketFd == NULL_SOCKET && socket->connectAttempts.empty())
+                    destroyPooledSocket(socket);
+            }
+
+            releasedSockets.clear();
+        }
+
+#ifdef _WIN32
+        WinSock winSock;
+#endif
+
+        Transport& transport;
+
+        Waker waker;
+        std::atomic<bool> wakeupPending{false};
+        MpscQueue<std::function<void()>> tasks;
+
+        std::vector<Slot> slots;
+        std::vector<uint32_t> freeSlots;
+
+        // storage for the accepted sockets, chunks are never moved so the sockets have stable addresses
+        static constexpr size_t POOL_CHUNK_SIZE = 64;
+        using PoolEntry = typename std::aligned_storage<sizeof(Socket), alignof(Socket)>::type;
+        struct PoolChunk final
+        {
+            PoolEntry entries[POOL_CHUNK_SIZE];
+        };
+
+        std::vector<std::unique_ptr<PoolChunk>> poolChunks;
+        std::vector<PoolEntry*> freePoolEntries;
+        std::vector<Socket*> releasedSockets;
+
+        std::vector<pollfd> pollFds;
+        std::vector<SocketHandle> pollHandles;
+
+        size_t writeQuantum = 0;
+        size_t writeBudget = 0;
+        uint64_t writeUpdate = 0;
+        std::vector<SocketHandle> writableSockets;
+
+        float bufferTuningInterval = 1.0f;
+        uint64_t bufferMemoryBudget = 0;
+        uint64_t bufferMemory = 0;
+        std::chrono::steady_clock::time_point nextBufferTuningTime;
+        std::vector<BufferTarget> bufferTargets;
+
+        std::vector<uint8_t> readBuffer = std::vector<uint8_t>(65536);
+        std::vector<uint8_t> inData;
+
+        std::chrono::steady_clock::time_point previousTime;
+        std::chrono::system_clock::time_point pollTime;
+
+        float spinTime = 0.0f;
+        uint32_t busyPollTime = 0;
+
+        std::vector<Timer> timers;
+        std::unordered_set<TimerId> activeTimers;
+        TimerId lastTimerId = 0;
+
+        TokenBucket pacingBucket;
+    };
+
+    Socket::Socket(Network& aNetwork):
+        network(aNetwork), handle(network.createHandle(*this))
+    {
+    }
+
+    Socket::~Socket()
+    {
+        cancelConnectAttempts();
+        network.destroyHandle(handle);
+
+        // the errors of the last write are ignored
+        errorCallback = nullptr;
+
+        try
+        {
+            writeData();
+        }
+        catch (...)
+        {
+        }
+
+        closeSocketFd();
+    }
+
+    Socket::Socket(Socket&& other):
+        network(other.network),
+        handle(other.handle),
+        socketFd(other.socketFd),
+        ready(other.ready),
+        blocking(other.blocking),
+        localAddress(other.localAddress),
+        localPort(other.localPort),
+        remoteAddress(other.remoteAddress),
+        remotePort(other.remotePort),
+        connectTimeout(other.connectTimeout),
+        timeSinceConnect(other.timeSinceConnect),
+        connectAttemptDelay(other.connectAttemptDelay),
+        connectAddresses(std::move(other.connectAddresses)),
+        nextConnectAddress(other.nextConnectAddress),
+        connectAttempts(std::move(other.connectAttempts)),
+        connectAttemptTimer(other.connectAttemptTimer),
+        accepting(other.accepting),
+        connecting(other.connecting),
+        acceptQueueSize(other.acceptQueueSize),
+        fastOpenQueueSize(other.fastOpenQueueSize),
+        fastOpen(other.fastOpen),
+        fastOpenPending(other.fastOpenPending),
+        pacingBucket(other.pacingBucket),
+        pacingPaused(other.pacingPaused),
+        compressor(std::move(other.compressor)),
+        compressionThreshold(other.compressionThreshold),
+        compressedInData(std::move(other.compressedInData)),
+        compressionStats(other.compressionStats),
+        sendBufferSize(other.sendBufferSize),
+        receiveBufferSize(other.receiveBufferSize),
+        bufferTuning(other.bufferTuning),
+        tuningBytesWritten(other.tuningBytesWritten),
+        tuningBytesRead(other.tuningBytesRead),
+        receiveBufferLimited(other.receiveBufferLimited),
+        bufferTuningTime(other.bufferTuningTime),
+        latencyStats(std::move(other.latencyStats)),
+        receiveTime(other.receiveTime),
+        writtenBytes(other.writtenBytes),
+        timestampKey(other.timestampKey),
+        queuedSends(std::move(other.queuedSends)),
+        pendingWrites(std::move(other.pendingWrites)),
+        relayTarget(other.relayTarget),
+        relaySource(other.relaySource),
+#ifdef __linux__
+        relayPipe{other.relayPipe[0], other.relayPipe[1]},
+#else
+        relayBuffer(std::move(other.relayBuffer)),
+#endif
+        relaySize(other.relaySize),
+        readShutdown(other.readShutdown),
+        writeShutdown(other.writeShutdown),
+        readCallback(std::move(other.readCallback)),
+        closeCallback(std::move(other.closeCallback)),
+        acceptCallback(std::move(other.acceptCallback)),
+        connectCallback(std::move(other.connectCallback)),
+        connectErrorCallback(std::move(other.connectErrorCallback)),
+        errorCallback(std::move(other.errorCallback)),
+        outData(std::move(other.outData)),
+        outDataOffset(other.outDataOffset),
+        sharedOutData(std::move(other.sharedOutData)),
+        sharedOutDataSize(other.sharedOutDataSize),
+        sharedOwnedSize(other.sharedOwnedSize),
+        writePriority(other.writePriority),
+        lastWriteUpdate(other.lastWriteUpdate)
+    {
+        // the connection keeps its handle, the moved-from socket gets a new one
+        network.moveHandle(*this);
+        other.handle = network.createHandle(other);
+
+        other.socketFd = NULL_SOCKET;
+#ifdef __linux__
+        other.relayPipe[0] = other.relayPipe[1] = -1;
+#endif
+        other.closeRelay();
+        other.ready = false;
+        other.blocking = true;
+        other.localAddress = 0;
+        other.localPort = 0;
+        other.remoteAddress = 0;
+        other.remotePort = 0;
+        other.connecting = false;
+        other.connectTimeout = 10.0f;
+        other.timeSinceConnect = 0.0f;
+        other.connectAddresses.clear();
+        other.nextConnectAddress = 0;
+        other.connectAttempts.clear();
+        other.connectAttemptTimer = 0;
+        other.clearOutData();
+        other.queuedSends.clear();
+        other.pendingWrites.clear();
+
+        other.scheduleRelease();
+    }
+
+    Socket& Socket::operator=(Socket&& other)
+    {
+        if (&other != this)
+        {
+            cancelConnectAttempts();
+            closeSocketFd();
+
+            network.swapHandles(*this, other);
+
+            socketFd = other.socketFd;
+            ready = other.ready;
+            blocking = other.blocking;
+            localAddress = other.localAddress;
+            localPort = other.localPort;
+            remoteAddress = other.remoteAddress;
+            remotePort = other.remotePort;
+            connectTimeout = other.connectTimeout;
+            timeSinceConnect = other.timeSinceConnect;
+            connectAttemptDelay = other.connectAttemptDelay;
+            connectAddresses = std::move(other.connectAddresses);
+            nextConnectAddress = other.nextConnectAddress;
+            connectAttempts = std::move(other.connectAttempts);
+            connectAttemptTimer = other.connectAttemptTimer;
+            accepting = other.accepting;
+            connecting = other.connecting;
+            acceptQueueSize = other.acceptQueueSize;
+            fastOpenQueueSize = other.fastOpenQueueSize;
+            fastOpen = other.fastOpen;
+            fastOpenPending = other.fastOpenPending;
+            pacingBucket = other.pacingBucket;
+            pacingPaused = other.pacingPaused;
+            compressor = std::move(other.compressor);
+            compressionThreshold = other.compressionThreshold;
+            compressedInData = std::move(other.compressedInData);
+            ++compressedInDataGeneration;
+            compressionStats = other.compressionStats;
+            sendBufferSize = other.sendBufferSize;
+            receiveBufferSize = other.receiveBufferSize;
+            bufferTuning = other.bufferTuning;
+            tuningBytesWritten = other.tuningBytesWritten;
+            tuningBytesRead = other.tuningBytesRead;
+            receiveBufferLimited = other.receiveBufferLimited;
+            bufferTuningTime = other.bufferTuningTime;
+            latencyStats = std::move(other.latencyStats);
+            receiveTime = other.receiveTime;
+            writtenBytes = other.writtenBytes;
+            timestampKey = other.timestampKey;
+            queuedSends = std::move(other.queuedSends);
+            pendingWrites = std::move(other.pendingWrites);
+            relayTarget = other.relayTarget;
+            relaySource = other.relaySource;
+#ifdef __linux__
+            relayPipe[0] = other.relayPipe[0];
+            relayPipe[1] = other.relayPipe[1];
+            other.relayPipe[0] = other.relayPipe[1] = -1;
+#else
+            relayBuffer = std::move(other.relayBuffer);
+#endif
+            relaySize = other.relaySize;
+            readShutdown = other.readShutdown;
+            writeShutdown = other.writeShutdown;
+            readCallback = std::move(other.readCallback);
+            closeCallback = std::move(other.closeCallback);
+            acceptCallback = std::move(other.acceptCallback);
+            connectCallback = std::move(other.connectCallback);
+            connectErrorCallback = std::move(other.connectErrorCallback);
+            errorCallback = std::move(other.errorCallback);
+            outData = std::move(other.outData);
+            outDataOffset = other.outDataOffset;
+            sharedOutData = std::move(other.sharedOutData);
+            sharedOutDataSize = other.sharedOutDataSize;
+            sharedOwnedSize = other.sharedOwnedSize;
+            writePriority = other.writePriority;
+            lastWriteUpdate = other.lastWriteUpdate;
+
+            other.socketFd = NULL_SOCKET;
+            other.closeRelay();
+            other.ready = false;
+            other.blocking = true;
+            other.localAddress = 0;
+            other.localPort = 0;
+            other.remoteAddress = 0;
+            other.remotePort = 0;
+            other.accepting = false;
+            other.connecting = false;
+            other.connectTimeout = 10.0f;
+            other.timeSinceConnect = 0.0f;
+            other.connectAddresses.clear();
+            other.nextConnectAddress = 0;
+            other.connectAttempts.clear();
+            other.connectAttemptTimer = 0;
+            other.clearOutData();
+            other.queuedSends.clear();
+            other.pendingWrites.clear();
+
+            other.scheduleRelease();
+        }
+
+        return *this;
+    }
+
+    void Socket::setSocketOptions()
+    {
+#ifdef SO_BUSY_POLL
+        if (network.busyPollTime)
+        {
+            int value = static_cast<int>(network.busyPollTime);
+            if (getTransport().setOption(socketFd, SOL_SOCKET, SO_BUSY_POLL, &value, sizeof(value)) != 0)
+                throw std::system_error(errno, std::system_category(), "setsockopt(SO_BUSY_POLL) failed");
+
+#  ifdef SO_PREFER_BUSY_POLL
+            value = 1;
+            // not supported before Linux 5.11 and needs CAP_NET_ADMIN, busy polling still works without it
+            if (getTransport().setOption(socketFd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &value, sizeof(value)) != 0 &&
+                errno != ENOPROTOOPT && errno != EPERM)
+                throw std::system_error(errno, std::system_category(), "setsockopt(SO_PREFER_BUSY_POLL) failed");
+#  endif
+        }
+#endif
+    }
+
+    void Socket::readData()
+    {
+#if defined(__APPLE__)
+        int flags = 0;
+#elif defined(_WIN32)
+        int flags = 0;
+#else
+        int flags = MSG_NOSIGNAL;
+#endif
+
+        int64_t size;
+
+#ifdef __linux__
+        if (latencyStats)
+            size = receiveTimestamped(flags);
+        else
+#endif
+            size = network.transport.recv(socketFd, network.readBuffer.data(), network.readBuffer.size(), flags);
+
+        if (size > 0)
+        {
+            tuningBytesRead += static_cast<uint64_t>(size);
+
+#ifdef __linux__
+            // the receive window was full, so the peer had to wait for the read, a read that fills
+            // the shared read buffer can leave data in the socket, which counts too
+            if (bufferTuning && receiveBufferSize > 0)
+            {
+                int64_t queued = size;
+                int remaining = 0;
+
+                if (static_cast<size_t>(size) == network.readBuffer.size() &&
+                    ioctl(socketFd, FIONREAD, &remaining) == 0)
+                    queued += remaining;
+
+                if (queued >= receiveBufferSize)
+                    receiveBufferLimited = true;
+            }
+#endif
+        }
+
+        if (size > 0 && latencyStats)
+            recordReceiveDelay();
+
+        if (size > 0 && compressor)
+            readCompressedData(static_cast<size_t>(size));
+        else if (size > 0)
+        {
+            // the buffers are shared by all sockets of the network
+            std::vector<uint8_t>& inData = network.inData;
+            inData.assign(network.readBuffer.begin(), network.readBuffer.begin() + size);
+
+            if (readCallback)
+                readCallback(*this, inData);
+        }
+        else if (size < 0)
+        {
+            int error = getLastError();
+
+#ifdef _WIN32
+            if (error != WSAEWOULDBLOCK &&
+                error != WSAEINPROGRESS)
+#else
+            if (error != EAGAIN &&
+                error != EWOULDBLOCK &&
+                error != EINPROGRESS)
+#endif
+            {
+                if (errorCallback)
+                    return disconnected(std::error_code(error, std::system_category()));
+
+                const std::string address = getRemoteAddressString();
+
+                disconnected();
+
+                if (error == ECONNRESET)
+                    throw std::system_error(error, std::system_category(), "Connection to " + address + " reset by peer");
+                else if (error == ECONNREFUSED)
+                    throw std::system_error(error, std::system_category(), "Connection to " + address + " refused");
+                else
+                    throw std::system_error(error, std::system_category(), "Failed to read from " + address);
+            }
+        }
+        else // size == 0
+            disconnected();
+    }
+
+    void Socket::setBufferTuning(bool newBufferTuning)
+    {
+#ifdef __linux__
+        if (newBufferTuning && !getTransport().isSystem())
+            throw std::runtime_error("Can not tune buffers, the transport does not support it");
+
+        bufferTuning = newBufferTuning;
+        tuningBytesWritten = 0;
+        tuningBytesRead = 0;
+        receiveBufferLimited = false;
+        bufferTuningTime = std::chrono::steady_clock::now();
+#else
+        if (newBufferTuning)
+            throw std::runtime_error("Buffer tuning is not supported on this platform");
+#endif
+    }
+
+    bool Socket::getBufferTargets(std::chrono::steady_clock::time_point currentTime, uint64_t& sendTarget, uint64_t& receiveTarget)
+    {
+#ifdef __linux__
+        const double elapsed = std::chrono::duration<double>(currentTime - bufferTuningTime).count();
+        if (elapsed <= 0.0) return false;
+
+        tcp_info info;
+        socklen_t length = sizeof(info);
+
+        if (getsockopt(socketFd, IPPROTO_TCP, TCP_INFO, &info, &length) != 0)
+            return false;
+
+        // the round-trip times are in microseconds, the receiver estimates its own when it only receives
+        const double roundTripTime = info.tcpi_rtt / 1000000.0;
+        const double receiveRoundTripTime = (info.tcpi_rcv_rtt ? info.tcpi_rcv_rtt : info.tcpi_rtt) / 1000000.0;
+
+        double sendSize = 2.0 * tuningBytesWritten / elapsed * roundTripTime;
+        double receiveSize = 2.0 * tuningBytesRead / elapsed * receiveRoundTripTime;
+
+        // on short paths the throughput is limited by the system calls rather than the round trips,
+        // so a buffer that holds back the data is doubled even if it is above the bandwidth-delay product
+        const uint64_t inFlight = static_cast<uint64_t>(info.tcpi_unacked) * info.tcpi_snd_mss;
+        if (sendBufferSize > 0 && info.tcpi_unacked < info.tcpi_snd_cwnd &&
+            inFlight >= static_cast<uint64_t>(sendBufferSize) / 2)
+            sendSize = std::max(sendSize, 2.0 * sendBufferSize);
+
+        if (receiveBufferLimited)
+            receiveSize = std::max(receiveSize, 2.0 * receiveBufferSize);
+
+        // the buffers hold at least a few segments and shrink gradually, so a short drop
+        // of the throughput does not limit it when it recovers
+        sendSize = std::max({sendSize, 4.0 * info.tcpi_snd_mss, sendBufferSize / 2.0});
+        receiveSize = std::max({receiveSize, 4.0 * info.tcpi_rcv_mss, receiveBufferSize / 2.0});
+
+        sendTarget = static_cast<uint64_t>(std::min(sendSize, static_cast<double>(MAX_TUNED_BUFFER_SIZE)));
+        receiveTarget = static_cast<uint64_t>(std::min(receiveSize, static_cast<double>(MAX_TUNED_BUFFER_SIZE)));
+
+        tuningBytesWritten = 0;
+        tuningBytesRead = 0;
+        receiveBufferLimited = false;
+        bufferTuningTime = currentTime;
+
+        return true;
+#else
+        (void)currentTime;
+        (void)sendTarget;
+        (void)receiveTarget;
+        return false;
+#endif
+    }
+
+    void Socket::resizeBuffers(int newSendBufferSize, int newReceiveBufferSize)
+    {
+        // small changes are skipped, so the sizes do not follow every fluctuation of the throughput
+        auto changed = [](int size, int newSize) {
+            return size == 0 || newSize > size + size / 4 || newSize < size - size / 4;
+        };
+
+        if (changed(sendBufferSize, newSendBufferSize))
+        {
+            setBufferSizeOption(SO_SNDBUF, newSendBufferSize);
+            sendBufferSize = newSendBufferSize;
+        }
+
+        if (changed(receiveBufferSize, newReceiveBufferSize))
+        {
+            setBufferSizeOption(SO_RCVBUF, newReceiveBufferSize);
+            receiveBufferSize = newReceiveBufferSize;
+        }
+    }
+
+    void Socket::setTimestamping(bool newTimestamping)
+    {
+        if (newTimestamping == (latencyStats != nullptr))
+            return;
+
+#ifdef __linux__
+        if (newTimestamping && !getTransport().isSystem())
+            throw std::runtime_error("Can not timestamp, the transport does not support it");
+
+        if (newTimestamping)
+            latencyStats.reset(new LatencyStats());
+        else
+            latencyStats.reset();
+
+        receiveTime = std::chrono::system_clock::time_point();
+        queuedSends.clear();
+
+        // the option can be set only on connected sockets, the others get it when they connect
+        if (socketFd != NULL_SOCKET && ready && !accepting)
+            setTimestampingOption();
+#else
+        throw std::runtime_error("Timestamping is not supported on this platform");
+#endif
+    }
+
+    int64_t Socket::receiveTimestamped(int flags)
+    {
+#ifdef __linux__
+        iovec vector;
+        vector.iov_base = network.readBuffer.data();
+        vector.iov_len = network.readBuffer.size();
+
+        alignas(cmsghdr) char control[256];
+        msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = &vector;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        const ssize_t size = recvmsg(socketFd, &message, flags);
+
+        receiveTime = std::chrono::system_clock::time_point();
+
+        if (size > 0)
+        {
+            for (cmsghdr* header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header))
+            {
+                if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_TIMESTAMPING)
+                {
+                    // the software timestamp is the first one
+                    scm_timestamping timestamping;
+                    memcpy(&timestamping, CMSG_DATA(header), sizeof(timestamping));
+
+                    receiveTime = std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                        std::chrono::seconds(timestamping.ts[0].tv_sec) + std::chrono::nanoseconds(timestamping.ts[0].tv_nsec)));
+                }
+            }
+        }
+
+        return size;
+#else
+        (void)flags;
+        return -1;
+#endif
+    }
+
+    void Socket::readTimestamps()
+    {
+#ifdef __linux__
+        for (;;)
+        {
+            alignas(cmsghdr) char control[256];
+            msghdr message;
+            memset(&message, 0, sizeof(message));
+            message.msg_control = control;
+            message.msg_controllen = sizeof(control);
+
+            if (recvmsg(socketFd, &message, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+                return;
+
+            scm_timestamping timestamping;
+            sock_extended_err error;
+            bool hasTimestamp = false;
+            bool hasError = false;
+
+            for (cmsghdr* header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header))
+            {
+                if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_TIMESTAMPING)
+                {
+                    memcpy(&timestamping, CMSG_DATA(header), sizeof(timestamping));
+                    hasTimestamp = true;
+                }
+                else if (header->cmsg_level == IPPROTO_IP && header->cmsg_type == IP_RECVERR)
+                {
+                    memcpy(&error, CMSG_DATA(header), sizeof(error));
+                    hasError = true;
+                }
+            }
+
+            if (!hasTimestamp || !hasError ||
+                error.ee_errno != ENOMSG ||
+                error.ee_origin != SO_EE_ORIGIN_TIMESTAMPING ||
+                error.ee_info != SCM_TSTAMP_SND)
+                continue;
+
+            const std::chrono::system_clock::time_point transmitTime(std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                std::chrono::seconds(timestamping.ts[0].tv_sec) + std::chrono::nanoseconds(timestamping.ts[0].tv_nsec)));
+
+            // the key is the offset of the last byte of the write, the writes coalesced into
+            // one segment before it are transmitted together with it
+            while (!pendingWrites.empty() &&
+                   static_cast<int32_t>(pendingWrites.front().first - error.ee_data) <= 0)
+            {
+                latencyStats->sendKernelDelay.record(getNanoseconds(transmitTime - pendingWrites.front().second));
+                pendingWrites.pop_front();
+            }
+        }
+#endif
+    }
+
+    void Socket::recordReceiveDelay()
+    {
+        if (receiveTime == std::chrono::system_clock::time_point())
+            return;
+
+        latencyStats->receiveWaitDelay.record(getNanoseconds(network.pollTime - receiveTime));
+        latencyStats->receiveDispatchDelay.record(getNanoseconds(std::chrono::system_clock::now() - network.pollTime));
+    }
+
+    void Socket::recordWrite(size_t size, std::chrono::system_clock::time_point writeTime)
+    {
+        writtenBytes += size;
+        timestampKey += static_cast<uint32_t>(size);
+
+        pendingWrites.emplace_back(timestampKey - 1, writeTime);
+        if (pendingWrites.size() > MAX_PENDING_TIMESTAMPS)
+            pendingWrites.pop_front();
+
+        while (!queuedSends.empty() && queuedSends.front().first <= writtenBytes)
+        {
+            latencyStats->sendQueueDelay.record(getNanoseconds(writeTime - queuedSends.front().second));
+            queuedSends.pop_front();
+        }
+    }
+
+    void Socket::readCompressedData(size_t size)
+    {
+        compressedInData.insert(compressedInData.end(), network.readBuffer.begin(), network.readBuffer.begin() + size);
+        compressionStats.compressedBytesReceived += size;
+
+        std::vector<uint8_t>& inData = network.inData;
+        const Compressor* currentCompressor = compressor.get();
+        const uint64_t generation = compressedInDataGeneration;
+        size_t offset = 0;
+
+        while (compressedInData.size() - offset >= COMPRESSION_HEADER_SIZE)
+        {
+            const uint8_t* header = compressedInData.data() + offset;
+            const uint32_t value = (static_cast<uint32_t>(header[0]) << 24) |
+                (static_cast<uint32_t>(header[1]) << 16) |
+                (static_cast<uint32_t>(header[2]) << 8) |
+                static_cast<uint32_t>(header[3]);
+            const size_t messageSize = value & ~COMPRESSED_FLAG;
+
+            // the message is rejected before it is buffered
+            if (messageSize > MAX_COMPRESSED_MESSAGE_SIZE)
+            {
+                if (errorCallback)
+                    return disconnected(std::make_error_code(std::errc::bad_message));
+
+                const std::string address = getRemoteAddressString();
+
+                disconnected();
+
+                throw std::runtime_error("Message from " + address + " too large");
+            }
+
+            if (compressedInData.size() - offset - COMPRESSION_HEADER_SIZE < messageSize)
+                break;
+
+            const uint8_t* message = header + COMPRESSION_HEADER_SIZE;
+            offset += COMPRESSION_HEADER_SIZE + messageSize;
+
+            inData.clear();
+
+            if (value & COMPRESSED_FLAG)
+            {
+                try
+                {
+                    compressor->decompress(message, messageSize, inData, MAX_DECOMPRESSED_MESSAGE_SIZE);
+                }
+                catch (const std::exception& e)
+                {
+                    if (errorCallback)
+                        return disconnected(std::make_error_code(std::errc::bad_message));
+
+                    const std::string address = getRemoteAddressString();
+
+                    disconnected();
+
+                    throw std::runtime_error("Failed to decompress data from " + address + ": " + e.what());
+                }
+            }
+            else
+                inData.assign(message, message + messageSize);
+
+            compressionStats.bytesReceived += inData.size();
+
+            if (readCallback)
+                readCallback(*this, inData);
+
+            // the callback could have closed, reconnected or moved the socket or changed the compressor,
+            // which discards the data the offset points into
+            if (socketFd == NULL_SOCKET || compressor.get() != currentCompressor ||
+                compressedInDataGeneration != generation)
+                return;
+        }
+
+        compressedInData.erase(compressedInData.begin(), compressedInData.begin() + static_cast<std::ptrdiff_t>(offset));
+    }
+
+    size_t Socket::getWriteAllowance()
+    {
+        size_t allowance = getOutDataSize();
+
+        if (pacingBucket.isEnabled() || network.pacingBucket.isEnabled())
+        {
+            auto currentTime = std::chrono::steady_clock::now();
+
+            if (pacingBucket.isEnabled())
+                allowance = std::min(allowance, pacingBucket.getAvailable(currentTime));
+
+            if (network.pacingBucket.isEnabled())
+                allowance = std::min(allowance, network.pacingBucket.getAvailable(currentTime));
+
+            if (allowance < getMinPacedWriteSize())
+                allowance = 0;
+        }
+
+        return allowance;
+    }
+
+    void Socket::consumeWriteAllowance(size_t size)
+    {
+        if (pacingBucket.isEnabled()) pacingBucket.consume(size);
+        if (network.pacingBucket.isEnabled()) network.pacingBucket.consume(size);
+    }
+
+    size_t Socket::getMinPacedWriteSize() const
+    {
+        size_t size = std::min(getOutDataSize(), MIN_PACED_WRITE_SIZE);
+
+        if (pacingBucket.isEnabled())
+            size = static_cast<size_t>(std::min(static_cast<uint64_t>(size), pacingBucket.getBurst()));
+
+        if (network.pacingBucket.isEnabled())
+            size = static_cast<size_t>(std::min(static_cast<uint64_t>(size), network.pacingBucket.getBurst()));
+
+        return size;
+    }
+
+    void Socket::pauseWriting()
+    {
+        const size_t size = getMinPacedWriteSize();
+
+        float delay = 0.0f;
+        if (pacingBucket.isEnabled()) delay = std::max(delay, pacingBucket.getDelay(size));
+        if (network.pacingBucket.isEnabled()) delay = std::max(delay, network.pacingBucket.getDelay(size));
+
+        pacingPaused = true;
+
+        Network& socketNetwork = network;
+        SocketHandle socketHandle = handle;
+
+        network.addTimer(delay, [&socketNetwork, socketHandle]() {
+            if (Socket* socket = socketNetwork.getSocket(socketHandle))
+                socket->pacingPaused = false;
+        });
+    }
+
+    Socket::Socket(Network& aNetwork, socket_t aSocketFd, bool aReady,
+           uint32_t aLocalAddress, uint16_t aLocalPort,
+           uint32_t aRemoteAddress, uint16_t aRemotePort):
+        network(aNetwork), handle(network.createHandle(*this)),
+        socketFd(aSocketFd), ready(aReady),
+        localAddress(aLocalAddress), localPort(aLocalPort),
+        remoteAddress(aRemoteAddress), remotePort(aRemotePort)
+    {
+    }
+
+    void Socket::acceptConnection()
+    {
+        const SocketHandle serverHandle = handle;
+
+        // a non-blocking listener accepts all pending connections, up to a limit per update
+        for (size_t count = 0; count < (blocking ? 1 : MAX_ACCEPTS_PER_UPDATE); ++count)
+        {
+            sockaddr_in address;
+            socket_t clientFd = network.transport.accept(socketFd, address);
+
+            if (clientFd == NULL_SOCKET)
+            {
+                int error = getLastError();
+
+#ifdef _WIN32
+                if (error != WSAEWOULDBLOCK &&
+                    error != WSAEINPROGRESS)
+#else
+                if (error != EAGAIN &&
+                    error != EWOULDBLOCK &&
+                    error != EINPROGRESS)
+#endif
+                {
+                    // the listening socket stays open, the error could be temporary (e.g. out of descriptors)
+                    if (errorCallback)
+                        errorCallback(*this, std::error_code(error, std::system_category()));
+                    else
+                        throw std::system_error(error, std::system_category(), "Failed to accept client");
+                }
+
+                return;
+            }
+
+            Socket& socket = network.createPooledSocket(clientFd, localAddress, localPort,
+                                                        address.sin_addr.s_addr,
+                                                        ntohs(address.sin_port));
+
+            try
+            {
+                // accepted sockets inherit the blocking mode of the listening socket
+                if (!blocking)
+                    socket.setBlocking(false);
+
+                socket.setSocketOptions();
+
+                // the kernel buffers are inherited from the listening socket
+                socket.sendBufferSize = sendBufferSize;
+                socket.receiveBufferSize = receiveBufferSize;
+
+                if (bufferTuning)
+                    socket.setBufferTuning(true);
+
+                if (latencyStats)
+                    socket.setTimestamping(true);
+            }
+            catch (const std::system_error& e)
+            {
+                // the connection is dropped, the listening socket stays open
+                socket.close();
+
+                if (!errorCallback)
+                    throw;
+
+                errorCallback(*this, e.code());
+
+                // the callback could have closed or moved the listening socket
+                if (network.getSocket(serverHandle) != this || !accepting)
+                    return;
+
+                continue;
+            }
+            catch (...)
+            {
+                socket.close();
+                throw;
+            }
+
+            socket.errorCallback = errorCallback;
+
+            // the callback can keep the handle of the socket or move it out of the pool
+            if (acceptCallback)
+                acceptCallback(*this, socket);
+
+            // the callback could have closed or moved the listening socket
+            if (network.getSocket(serverHandle) != this || !accepting)
+                return;
+        }
+    }
+
+    void Socket::relayData()
+    {
+        Socket* target = network.getSocket(relayTarget);
+
+        // the target is gone, there is nowhere to pass the data to
+        if (!target || target->relaySource != handle)
+        {
+            disconnected();
+            return;
+        }
+
+#ifdef __linux__
+        ssize_t size = splice(socketFd, nullptr, relayPipe[1], nullptr,
+                              RELAY_BUFFER_SIZE - relaySize, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+#else
+        const size_t bufferSize = std::min(network.readBuffer.size(), RELAY_BUFFER_SIZE - relaySize);
+#  ifdef _WIN32
+        int size = recv(socketFd, reinterpret_cast<char*>(network.readBuffer.data()), static_cast<int>(bufferSize), 0);
+#  else
+        ssize_t size = recv(socketFd, reinterpret_cast<char*>(network.readBuffer.data()), bufferSize, 0);
+#  endif
+        if (size > 0)
+            relayBuffer.insert(relayBuffer.end(), network.readBuffer.begin(), network.readBuffer.begin() + size);
+#endif
+
+        if (size > 0)
+        {
+            relaySize += static_cast<size_t>(size);
+            tuningBytesRead += static_cast<uint64_t>(size);
+            target->flushRelay();
+        }
+        else if (size < 0)
+        {
+            int error = getLastError();
+
+#ifdef _WIN32
+            if (error != WSAEWOULDBLOCK &&
+                error != WSAEINPROGRESS)
+#else
+            if (error != EAGAIN &&
+                error != EWOULDBLOCK &&
+                error != EINPROGRESS)
+#endif
+            {
+                if (errorCallback)
+                    return disconnected(std::error_code(error, std::system_category()));
+
+                const std::string address = getRemoteAddressString();
+
+                disconnected();
+
+                if (error == ECONNRESET)
+                    throw std::system_error(error, std::system_category(), "Connection to " + address + " reset by peer");
+                else
+                    throw std::system_error(error, std::system_category(), "Failed to relay from " + address);
+            }
+        }
+        else // size == 0
+        {
+            // the peer will not send anything more, pass the shutdown on after the buffered data
+            readShutdown = true;
+            target->flushRelay();
+            closeFinishedRelay();
+        }
+    }
+
+    void Socket::flushRelay()
+    {
+        Socket* source = network.getSocket(relaySource);
+
+        if (!source || source->relayTarget != handle)
+        {
+            relaySource = SocketHandle();
+            return;
+        }
+
+        // the data sent before the relay was started goes out first
+        if (!ready || hasOutData()) return;
+
+        while (source->relaySize > 0)
+        {
+#if defined(__linux__)
+            ssize_t size = splice(source->relayPipe[0], nullptr, socketFd, nullptr,
+                                  source->relaySize, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+#elif defined(_WIN32)
+            int size = ::send(socketFd, reinterpret_cast<const char*>(source->relayBuffer.data()),
+                              static_cast<int>(source->relaySize), 0);
+#elif defined(__APPLE__)
+            ssize_t size = ::send(socketFd, source->relayBuffer.data(), source->relaySize, 0);
+#else
+            ssize_t size = ::send(socketFd, source->relayBuffer.data(), source->relaySize, MSG_NOSIGNAL);
+#endif
+
+            if (size > 0)
+            {
+#ifndef __linux__
+                source->relayBuffer.erase(source->relayBuffer.begin(), source->relayBuffer.begin() + size);
+#endif
+                source->relaySize -= static_cast<size_t>(size);
+                tuningBytesWritten += static_cast<uint64_t>(size);
+            }
+            else
+            {
+                int error = getLastError();
+
+#ifdef _WIN32
+                if (error == WSAEWOULDBLOCK ||
+                    error == WSAEINPROGRESS)
+#else
+                if (error == EAGAIN ||
+                    error == EWOULDBLOCK ||
+                    error == EINPROGRESS)
+#endif
+                    return;
+
+                if (errorCallback)
+                    return disconnected(std::error_code(error, std::system_category()));
+
+                const std::string address = getRemoteAddressString();
+
+                disconnected();
+
+                if (error == EPIPE)
+                    throw std::system_error(error, std::system_category(), "Failed to relay data to " + address + ", socket has been shut down");
+                else if (error == ECONNRESET)
+                    throw std::system_error(error, std::system_category(), "Connection to " + address + " reset by peer");
+                else
+                    throw std::system_error(error, std::system_category(), "Failed to relay data to " + address);
+            }
+        }
+
+        if (source->readShutdown && !writeShutdown)
+        {
+#ifdef _WIN32
+            ::shutdown(socketFd, SD_SEND);
+#else
+            ::shutdown(socketFd, SHUT_WR);
+#endif
+            writeShutdown = true;
+            closeFinishedRelay();
+        }
+    }
+
+    void Socket::closeFinishedRelay()
+    {
+        if (socketFd != NULL_SOCKET && readShutdown && relaySize == 0 &&
+            (writeShutdown || !network.getSocket(relaySource)))
+            disconnected();
+    }
+
+    void Socket::closeRelayPeers(SocketHandle target, SocketHandle source, bool finished)
+    {
+        // the target only has to be closed if not everything was passed on to it
+        if (Socket* socket = network.getSocket(target))
+            if (socket->relaySource == handle)
+            {
+                socket->relaySource = SocketHandle();
+                if (finished)
+                    socket->closeFinishedRelay();
+                else
+                    socket->disconnected();
+            }
+
+        // the source has nowhere to pass its data to
+        if (Socket* socket = network.getSocket(source))
+            if (socket->relayTarget == handle)
+            {
+                if (socket->readShutdown && socket->relaySize == 0)
+                    socket->closeFinishedRelay();
+                else
+                    socket->disconnected();
+            }
+    }
+
+    Transport& Socket::getTransport() const
+    {
+        return network.transport;
+    }
+
+    void Socket::scheduleRelease()
+    {
+        if (pooled && !releasePending)
+        {
+            releasePending = true;
+            network.releasedSockets.push_back(this);
+        }
+    }
+
+    void Socket::connect(const std::vector<std::pair<uint32_t, uint16_t>>& addresses)
+    {
+        ready = false;
+        connecting = false;
+
+        if (addresses.empty())
+            throw std::runtime_error("No addresses to connect to");
+
+        // blocking sockets try the addresses one after another and are connected when this returns,
+        // the callbacks are called once for the whole connect
+        if (blocking)
+        {
+            std::function<void(Socket&)> savedConnectCallback = connectCallback;
+            std::function<void(Socket&)> savedConnectErrorCallback = connectErrorCallback;
+            connectCallback = nullptr;
+            connectErrorCallback = nullptr;
+
+            try
+            {
+                for (size_t i = 0; i < addresses.size(); ++i)
+                {
+                    try
+                    {
+                        connect(addresses[i].first, addresses[i].second);
+                        break;
+                    }
+                    catch (const std::system_error&)
+                    {
+                        if (i + 1 == addresses.size())
+                            throw;
+                    }
+                }
+            }
+            catch (...)
+            {
+                connectCallback = savedConnectCallback;
+                connectErrorCallback = savedConnectErrorCallback;
+
+                if (connectErrorCallback)
+                    connectErrorCallback(*this);
+
+                throw;
+            }
+
+            connectCallback = savedConnectCallback;
+            connectErrorCallback = savedConnectErrorCallback;
+
+            if (connectCallback)
+                connectCallback(*this);
+
+            return;
+        }
+
+        if (socketFd != NULL_SOCKET || !connectAttempts.empty())
+            close();
+
+        connectAddresses = addresses;
+        nextConnectAddress = 0;
+        remoteAddress = addresses.front().first;
+        remotePort = addresses.front().second;
+        connecting = true;
+
+        startConnectAttempt();
+    }
+
+    void Socket::startConnectAttempt()
+    {
+        if (connectAttemptTimer)
+        {
+            network.cancelTimer(connectAttemptTimer);
+            connectAttemptTimer = 0;
+        }
+
+        const std::pair<uint32_t, uint16_t> address = connectAddresses[nextConnectAddress++];
+
+        // the attempts are owned by the network, their callbacks find this socket by its handle
+        Network& socketNetwork = network;
+        const SocketHandle socketHandle = handle;
+
+        Socket& attempt = network.createPooledSocket();
+        attempt.blocking = false;
+        attempt.connectTimeout = connectTimeout;
+        attempt.sendBufferSize = sendBufferSize;
+        attempt.receiveBufferSize = receiveBufferSize;
+        attempt.fastOpen = fastOpen;
+        attempt.pacingBucket = pacingBucket;
+        attempt.setConnectCallback([&socketNetwork, socketHandle](Socket& attemptSocket) {
+            if (Socket* socket = socketNetwork.getSocket(socketHandle))
+                socket->connectAttemptSucceeded(attemptSocket);
+            else
+                attemptSocket.close();
+        });
+        attempt.setConnectErrorCallback([&socketNetwork, socketHandle](Socket& attemptSocket) {
+            if (Socket* socket = socketNetwork.getSocket(socketHandle))
+                socket->connectAttemptFailed(attemptSocket);
+            else
+                attemptSocket.close();
+        });
+        // called after the connect error callback, the error of the last attempt is the error of the connect
+        attempt.setErrorCallback([&socketNetwork, socketHandle](Socket&, const std::error_code& error) {
+            if (Socket* socket = socketNetwork.getSocket(socketHandle))
+                if (!socket->connecting && socket->connectAttempts.empty() &&
+                    socket->socketFd == NULL_SOCKET && socket->errorCallback)
+                    socket->errorCallback(*socket, error);
+        });
+
+        connectAttempts.push_back(attempt.handle);
+
+        try
+        {
+            attempt.connect(address.first, address.second);
+        }
+        catch (...)
+        {
+            // the connect error callback has already handled the failure
+            return;
+        }
+
+        // the next address is tried if this attempt does not finish in time
+        if (connecting && socketFd == NULL_SOCKET &&
+            !connectAttemptTimer && nextConnectAddress < connectAddresses.size())
+        {
+            connectAttemptTimer = network.addTimer(connectAttemptDelay, [&socketNetwork, socketHandle]() {
+                if (Socket* socket = socketNetwork.getSocket(socketHandle))
+                {
+                    socket->connectAttemptTimer = 0;
+                    socket->startConnectAttempt();
+                }
+            });
+        }
+    }
+
+    void Socket::connectAttemptSucceeded(Socket& attempt)
+    {
+        // the connection of the first successful attempt is taken over
+        socketFd = attempt.socketFd;
+        attempt.socketFd = NULL_SOCKET;
+        localAddress = attempt.localAddress;
+        localPort = attempt.localPort;
+        remoteAddress = attempt.remoteAddress;
+        remotePort = attempt.remotePort;
+
+        // the callback of the attempt is running, so it is not reset with the other attempts
+        connectAttempts.erase(std::remove(connectAttempts.begin(), connectAttempts.end(), attempt.handle),
+                              connectAttempts.end());
+        attempt.close();
+
+        cancelConnectAttempts();
+
+        if (blocking)
+            setFdBlocking(true);
+
+        if (pacingBucket.isEnabled())
+            setPacingRateOption();
+
+        connecting = false;
+        ready = true;
+        if (latencyStats)
+            setTimestampingOption();
+        if (connectCallback)
+            connectCallback(*this);
+    }
+
+    void Socket::connectAttemptFailed(Socket& attempt)
+    {
+        connectAttempts.erase(std::remove(connectAttempts.begin(), connectAttempts.end(), attempt.handle),
+                              connectAttempts.end());
+        attempt.close();
+
+        // the next address is tried right away instead of waiting for the delay
+        if (nextConnectAddress < connectAddresses.size())
+            startConnectAttempt();
+        else if (connectAttempts.empty())
+        {
+            cancelConnectAttempts();
+            connecting = false;
+
+            if (connectErrorCallback)
+                connectErrorCallback(*this);
+        }
+    }
+
+    void Socket::cancelConnectAttempts()
+    {
+        if (connectAttemptTimer)
+        {
+            network.cancelTimer(connectAttemptTimer);
+            connectAttemptTimer = 0;
+        }
+
+        for (const SocketHandle& attemptHandle : connectAttempts)
+        {
+            if (Socket* attempt = network.getSocket(attemptHandle))
+            {
+                attempt->connectCallback = nullptr;
+                attempt->connectErrorCallback = nullptr;
+                attempt->errorCallback = nullptr;
+                attempt->close();
+            }
+        }
+
+        connectAttempts.clear();
+        connectAddresses.clear();
+        nextConnectAddress = 0;
     }
 }
 #endif // CPPSOCKET_HPP
@@ -0,0 +1,116 @@
+//
+//  cppsocket
+//
+
+#ifndef CPPSOCKET_ZLIBCOMPRESSOR_HPP
+#define CPPSOCKET_ZLIBCOMPRESSOR_HPP
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include <zlib.h>
+#include "Socket.hpp"
+
+namespace cppsocket
+{
+    // Deflate stream flushed at the end of every message, needs linking with zlib (-lz)
+    class ZlibCompressor final: public Compressor
+    {
+    public:
+        explicit ZlibCompressor(int aLevel = Z_DEFAULT_COMPRESSION)
+        {
+            std::memset(&deflateStream, 0, sizeof(deflateStream));
+            std::memset(&inflateStream, 0, sizeof(inflateStream));
+
+            if (deflateInit(&deflateStream, aLevel) != Z_OK)
+                throw std::runtime_error("Failed to initialize deflate stream");
+
+            if (inflateInit(&inflateStream) != Z_OK)
+            {
+                deflateEnd(&deflateStream);
+                throw std::runtime_error("Failed to initialize inflate stream");
+            }
+        }
+
+        ~ZlibCompressor()
+        {
+            deflateEnd(&deflateStream);
+            inflateEnd(&inflateStream);
+        }
+
+        void compress(const uint8_t* data, size_t size, std::vector<uint8_t>& output) override
+        {
+            deflateStream.next_in = const_cast<Bytef*>(data);
+            deflateStream.avail_in = static_cast<uInt>(size);
+
+            // the sync flush adds at most a few bytes to the bound
+            size_t chunkSize = deflateBound(&deflateStream, static_cast<uLong>(size)) + 16;
+
+            do
+            {
+                const size_t offset = output.size();
+                output.resize(offset + chunkSize);
+
+                deflateStream.next_out = output.data() + offset;
+                deflateStream.avail_out = static_cast<uInt>(chunkSize);
+
+                int result = deflate(&deflateStream, Z_SYNC_FLUSH);
+                output.resize(output.size() - deflateStream.avail_out);
+
+                if (result != Z_OK && result != Z_BUF_ERROR)
+                    throw std::runtime_error("Failed to compress data");
+
+                chunkSize = 4096;
+            }
+            while (deflateStream.avail_out == 0);
+        }
+
+        void decompress(const uint8_t* data, size_t size, std::vector<uint8_t>& output, size_t maxSize) override
+        {
+            inflateStream.next_in = const_cast<Bytef*>(data);
+            inflateStream.avail_in = static_cast<uInt>(size);
+
+            const size_t start = output.size();
+            size_t chunkSize = std::max(size * 4, static_cast<size_t>(4096));
+
+            do
+            {
+                const size_t decompressedSize = output.size() - start;
+
+                if (decompressedSize > maxSize)
+                    throw std::runtime_error("Decompressed data too large");
+
+                // one byte over the limit is enough to detect that the data does not fit
+                chunkSize = std::min(chunkSize, maxSize - decompressedSize + 1);
+
+                const size_t offset = output.size();
+                output.resize(offset + chunkSize);
+
+                inflateStream.next_out = output.data() + offset;
+                inflateStream.avail_out = static_cast<uInt>(chunkSize);
+
+                int result = inflate(&inflateStream, Z_SYNC_FLUSH);
+                output.resize(output.size() - inflateStream.avail_out);
+
+                if (result != Z_OK && result != Z_BUF_ERROR)
+                    throw std::runtime_error(inflateStream.msg ? inflateStream.msg : "Failed to decompress data");
+
+                chunkSize *= 2;
+            }
+            while (inflateStream.avail_out == 0 || inflateStream.avail_in != 0);
+        }
+
+        void reset() override
+        {
+            deflateReset(&deflateStream);
+            inflateReset(&inflateStream);
+        }
+
+    private:
+        z_stream deflateStream;
+        z_stream inflateStream;
+    };
+}
+
+#endif // CPPSOCKET_ZLIBCOMPRESSOR_HPP
@@ -0,0 +1,1327 @@
+//
+//  cppsocket
+//
+
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <thread>
+#include "Socket.hpp"
+#include "BroadcastHub.hpp"
+#include "MemoryTransport.hpp"
+#include "Multiplexer.hpp"
+#include "ZlibCompressor.hpp"
+
+// Round trips over loopback through the optional features of the library,
+// every check throws if it fails
+static void printUsage(const std::string& executable)
+{
+    std::cout << "Usage: " << executable << " [--port port] [check...]" << std::endl;
+}
+
+static void check(bool condition, const std::string& message)
+{
+    if (!condition)
+        throw std::runtime_error(message);
+}
+
+// updates the network until the condition is true or the timeout in seconds expires
+static void updateUntil(cppsocket::Network& network, const std::function<bool()>& condition,
+                        const std::string& message, float timeout = 5.0f)
+{
+    const auto endTime = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(timeout));
+
+    while (!condition())
+    {
+        check(std::chrono::steady_clock::now() < endTime, message);
+        network.update(0.01f);
+    }
+}
+
+static std::string getLoopbackAddress(uint16_t port)
+{
+    return cppsocket::ipToString(htonl(INADDR_LOOPBACK)) + ":" + std::to_string(port);
+}
+
+// Sends from another thread to a socket of a network blocked in update
+static void checkSendFromAnyThread(uint16_t port)
+{
+    cppsocket::Network serverNetwork;
+    cppsocket::Socket server(serverNetwork);
+    std::promise<cppsocket::SocketHandle> accepted;
+    std::atomic<bool> running(true);
+
+    server.setBlocking(false);
+    server.startAccept(cppsocket::ANY_ADDRESS, port);
+    server.setAcceptCallback([&accepted](cppsocket::Socket&, cppsocket::Socket& c) {
+        c.startRead();
+        accepted.set_value(c.getHandle());
+    });
+
+    std::thread serverThread([&serverNetwork, &running]() {
+        while (running)
+            serverNetwork.update(-1.0f);
+    });
+
+    cppsocket::Network clientNetwork;
+    cppsocket::Socket client(clientNetwork);
+    std::vector<uint8_t> received;
+
+    client.setBlocking(false);
+    client.setReadCallback([&received](cppsocket::Socket&, const std::vector<uint8_t>& data) {
+        received.insert(received.end(), data.begin(), data.end());
+    });
+    client.connect(getLoopbackAddress(port));
+
+    std::future<cppsocket::SocketHandle> handle = accepted.get_future();
+    updateUntil(clientNetwork, [&handle]() {
+        return handle.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }, "Server did not accept the connection");
+
+    serverNetwork.sendFromAnyThread(handle.get(), {'p', 'i', 'n', 'g'});
+    updateUntil(clientNetwork, [&received]() { return received.size() >= 4; }, "Data sent from another thread was not received");
+    check(received == std::vector<uint8_t>{'p', 'i', 'n', 'g'}, "Received wrong data");
+
+    // the posted task must wake up the blocked update, otherwise the join never returns
+    serverNetwork.post([&running]() { running = false; });
+    serverThread.join();
+}
+
+// Busy polling is best-effort, the options the process is not allowed to set are skipped
+static void checkBusyPoll(uint16_t port)
+{
+    cppsocket::Network network;
+    network.setBusyPollTime(50);
+
+    cppsocket::Socket server(network);
+    server.setBlocking(false);
+    server.startAccept(cppsocket::ANY_ADDRESS, port);
+    server.setAcceptCallback([](cppsocket::Socket&, cppsocket::Socket& c) {
+        c.startRead();
+        c.setReadCallback([](cppsocket::Socket& socket, const std::vector<uint8_t>& data) {
+            socket.send(data);
+        });
+    });
+
+    cppsocket::Socket client(network);
+    size_t received = 0;
+
+    client.setBlocking(false);
+    client.setConnectCallback([](cppsocket::Socket& socket) {
+        socket.send({'e', 'c', 'h', 'o'});
+    });
+    client.setReadCallback([&received](cppsocket::Socket&, const std::vector<uint8_t>& data) {
+        received += data.size();
+    });
+    client.connect(getLoopbackAddress(port));
+
+    updateUntil(network, [&received]() { return received >= 4; }, "Echo with busy polling was not received");
+}
+
+// Paced sends with buckets smaller than a segment, on the socket and on the network
+static void checkPacing(uint16_t port)
+{
+    const uint64_t rate = 100000;
+    const size_t size = 20000;
+
+    for (bool networkPacing : {false, true})
+    {
+        cppsocket::Network network;
+        cppsocket::Socket server(network);
+
+        if (networkPacing)
+            network.setPacingRate(rate, 1000);
+
+        server.setBlocking(false);
+        server.startAccept(cppsocket::ANY_ADDRESS, port);
+        server.setAcceptCallback([networkPacing, rate, size](cppsocket::Socket&, cppsocket::Socket& c) {
+            if (!networkPacing)
+                c.setPacingRate(rate, 1000);
+            c.send(std::vector<uint8_t>(size, 'p'));
+        });
+
+        cppsocket::Socket client(network);
+        size_t received = 0;
+
+        client.setBlocking(false);
+        client.setReadCallback([&received](cppsocket::Socket&, const std::vector<uint8_t>& data) {
+            received += data.size();
+        });
+        client.connect(getLoopbackAddress(port));
+
+        const auto startTime = std::chrono::steady_clock::now();
+        updateUntil(network, [&received, size]() { return received >= size; }, "Paced data was not received");
+        const float elapsed = std::chrono::duration<float>(std::chrono::steady_clock::now() - startTime).count();
+
+        // everything after the first burst is limited by the rate
+        check(elapsed >= static_cast<float>(size - 1000) / rate * 0.9f, "Data was not paced");
+    }
+}
+
+// Cancelled timers must not wake up a blocking update
+static void checkCancelledTimers(uint16_t)
+{
+    cppsocket::Network network;
+    bool fired = false;
+
+    network.addTimer(0.2f, [&fired]() { fired = true; });
+
+    for (int i = 1; i <= 10; ++i)
+        network.cancelTimer(network.addTimer(i * 0.01f, []() {
+            throw std::runtime_error("Cancelled timer fired");
+        }));
+
+    size_t updates = 0;
+    while (!fired)
+    {
+        network.update(-1.0f);
+        ++updates;
+    }
+
+    check(updates == 1, "Update woke up for cancelled timers");
+}
+
+// Data sent right after connect is delivered whether there are one or many addresses to connect to
+static void checkSendWhileConnecting(uint16_t port)
+{
+    cppsocket::Network network;
+    cppsocket::Socket server(network);
+    size_t received = 0;
+
+    server.setBlocking(false);
+    server.startAccept(cppsocket::ANY_ADDRESS, port);
+    server.setAcceptCallback([&received](cppsocket::Socket&, cppsocket::Socket& c) {
+        c.startRead();
+        c.setReadCallback([&received](cppsocket::Socket&, const std::vector<uint8_t>& data) {
+            received += data.size();
+        });
+    });
+
+    const std::vector<std::pair<uint32_t, uint16_t>> addresses = {
+        {htonl(INADDR_LOOPBACK), port},
+        {htonl(INADDR_LOOPBACK + 1), port}
+    };
+
+    for (size_t count : {static_cast<size_t>(1), addresses.size()})
+    {
+        cppsocket::Socket client(network);
+        client.setBlocking(false);
+        client.connect(std::vector<std::pair<uint32_t, uint16_t>>(addresses.begin(), addresses.begin() + static_cast<std::ptrdiff_t>(count)));
+        client.send({'e', 'a', 'r', 'l', 'y'});
+
+        received = 0;
+        updateUntil(network, [&received]() { return received >= 5; }, "Data sent while connecting was not received");
+    }
+}
+
+#ifdef __linux__
+// creates a non-blocking system socket for the peers that need more control than the library gives
+static int createRawSocket()
+{
+    const int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+    check(fd != -1, "Failed to create socket");
+    return fd;
+}
+
+// binds a system socket to an ephemeral port of the loopback address
+static uint16_t bindRawSocket(int fd)
+{
+    sockaddr_in address = {};
+    socklen_t addressLength = sizeof(address);
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    check(::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0 &&
+          ::getsockname(fd, reinterpret_cast<sockaddr*>(&address), &addressLength) == 0, "Failed to bind socket");
+    return ntohs(address.sin_port);
+}
+
+// starts a listener that does not answer, the SYNs to a listener with a full accept queue are dropped
+static uint16_t startSilentListener(int& listenFd, int& fillerFd)
+{
+    listenFd = createRawSocket();
+    const uint16_t silentPort = bindRawSocket(listenFd);
+    check(::listen(listenFd, 0) == 0, "Failed to listen");
+
+    fillerFd = createRawSocket();
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(silentPort);
+    check(::connect(fillerFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0 || errno == EINPROGRESS, "Failed to fill the accept queue");
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    return silentPort;
+}
+#endif
+
+// Non-blocking connects start the next attempt after the attempt delay when an address does not answer,
+// blocking connects try the addresses in order and return connected
+static void checkConnectAttempts(uint16_t port)
+{
+#ifdef __linux__
+    cppsocket::Network network;
+    cppsocket::Socket server(network);
+    std::string received;
+
+    server.setBlocking(false);
+    server.startAccept(cppsocket::ANY_ADDRESS, port);
+    server.setAcceptCallback([&received](cppsocket::Socket&, cppsocket::Socket& c) {
+        c.startRead();
+        c.setReadCallback([&received](cppsocket::Socket&, const std::vector<uint8_t>& data) {
+            received.append(data.begin(), data.end());
+        });
+    });
+
+    int silentFd;
+    int fillerFd;
+    const uint16_t silentPort = startSilentListener(silentFd, fillerFd);
+
+    const float delay = 0.2f;
+    cppsocket::Socket client(network);
+    size_t connects = 0;
+
+    client.setBlocking(false);
+    client.setConnectAttemptDelay(delay);
+    client.setConnectCallback([&connects](cppsocket::Socket&) { ++connects; });
+    client.connect({{htonl(INADDR_LOOPBACK), silentPort}, {htonl(INADDR_LOOPBACK), port}});
+    client.send({'l', 'a', 't', 'e'});
+
+    const auto startTime = std::chrono::steady_clock::now();
+    updateUntil(network, [&received]() { return received.size() >= 4; }, "Second address was not connected to");
+    const float elapsed = std::chrono::duration<float>(std::chrono::steady_clock::now() - startTime).count();
+
+    check(received == "late", "Data sent while connecting was not received");
+    check(connects == 1 && client.isReady() && client.getRemotePort() == port, "Wrong connection");
+    check(elapsed >= delay * 0.9f, "Second address was connected to before the attempt delay");
+
+    // a port without a listener refuses the connection
+    const int closedFd = createRawSocket();
+    const uint16_t closedPort = bindRawSocket(closedFd);
+
+    cppsocket::Socket blockingClient(network);
+    size_t blockingConnects = 0;
+    size_t blockingErrors = 0;
+
+    blockingClient.setConnectCallback([&blockingConnects](cppsocket::Socket&) { ++blockingConnects; });
+    blockingClient.setConnectErrorCallback([&blockingErrors](cppsocket::Socket&) { ++blockingErrors; });
+    blockingClient.connect({{htonl(INADDR_LOOPBACK), closedPort}, {htonl(INADDR_LOOPBACK), port}});
+
+    check(blockingClient.isReady() && blockingClient.getRemotePort() == port, "Blocking socket was not connected");
+    check(blockingConnects == 1 && blockingErrors == 0, "Wrong callbacks of the blocking connect");
+
+    ::close(closedFd);
+    ::close(fillerFd);
+    ::close(silentFd);
+#else
+    (void)port;
+#endif
+}
+
+// Fast Open connects that report the connection after the handshake and the refused ones as errors,
+// the data goes into the SYN when the kernel has Fast Open enabled (net.ipv4.tcp_fastopen)
+static void checkFastOpen(uint16_t port)
+{
+#ifdef __linux__
+    cppsocket::Network network;
+    cppsocket::Socket server(network);
+    std::string received;
+
+    server.setBlocking(false);
+    server.setFastOpenQueueSize(16);
+    server.startAccept(cppsocket::ANY_ADDRESS, port);
+    server.setAcceptCallback([&received](cppsocket::Socket&, cppsocket::Socket& c) {
+        c.startRead();
+        c.setReadCallback([&received](cppsocket::Socket&, const std::vector<uint8_t>& data) {
+            received.append(data.begin(), data.end());
+        });
+    });
+
+    // the first connection gets the cookie for the following ones
+    for (int i = 0; i < 2; ++i)
+    {
+        cppsocket::Socket client(network);
+        size_t connects = 0;
+
+        client.setBlocking(false);
+        client.setFastOpen(true);
+        client.setConnectCallback([&connects](cppsocket::Socket&) { ++connects; });
+        client.connect(getLoopbackAddress(port));
+        client.send({'f', 'a', 's', 't'});
+
+        received.clear();
+        updateUntil(network, [&received, &connects]() { return received.size() >= 4 && connects == 1; }, "Fast Open connection was not established");
+        check(received == "fast", "Wrong data: " + received);
+    }
+
+    // a port without a listener refuses the connection
+    const int closedFd = createRawSocket();
+    const uint16_t closedPort = bindRawSocket(closedFd);
+
+    cppsocket::Socket client(network);
+    size_t connects = 0;
+    bool failed = false;
+    std::error_code error;
+
+    client.setBlocking(false);
+    client.setFastOpen(true);
+    client.setConnectCallback([&connects](cppsocket::Socket&) { ++connects; });
+    client.setConnectErrorCallback([&failed](cppsocket::Socket&) { failed = true; });
+    client.setErrorCallback([&error](cppsocket::Socket&, const std::error_code& e) { error = e; });
+    client.connect(getLoopbackAddress(closedPort));
+    client.send({'l', 'o', 's', 't'});
+
+    updateUntil(network, [&failed, &client]() {
+        check(!client.isReady(), "Refused Fast Open connection was reported as ready");
+        return failed;
+    }, "Refused Fast Open connection was not reported");
+    check(connects == 0, "Refused Fast Open connection called the connect callback");
+    check(error == std::errc::connection_refused, "Wrong error: " + error.message());
+
+    ::close(closedFd);
+#else
+    (void)port;
+#endif
+}
+
+// Requests over the in-flight limit, a response for a request that has not been sent yet,
+// a server destroyed before its listening socket, a reconnect and a request over the frame size limit
+static void checkMultiplexer(uint16_t port)
+{
+    cppsocket::Network network;
+    cppsocket::Socket listener(network);
+    std::unique_ptr<cppsocket::MultiplexedServer> server(new cppsocket::MultiplexedServer(listener));
+
+    listener.setBlocking(false);
+    listener.startAccept(cppsocket::ANY_ADDRESS, port);
+    server->setRequestCallback([](cppsocket::Socket& socket, uint32_t id, const std::vector<uint8_t>& request) {
+        // the response for the second request comes before it is sent and must be ignored
+        if (id == 0)
+            cppsocket::MultiplexedServer::sendResponse(socket, 1, request);
+
+        cppsocket::MultiplexedServer::sendResponse(socket, id, request);
+    });
+
+    cppsocket::Socket socket(network);
+    cppsocket::MultiplexedClient client(socket, 1);
+    std::vector<std::vector<uint8_t>> responses;
+
+    socket.setBlocking(false);
+    socket.connect(getLoopbackAddress(port));
+
+    for (uint8_t i = 0; i < 2; ++i)
+        client.sendRequest({i}, [&responses, &client](const std::error_code& error, const std::vector<uint8_t>& response) {
+            check(!error, "Request failed: " + error.message());
+            check(client.getInFlightCount() <= 1, "In-flight limit exceeded");
+            responses.push_back(response);
+        });
+
+    updateUntil(network, [&responses]() { return responses.size() >= 2; }, "Responses were not received");
+    check(responses[0] == std::vector<uint8_t>{0} && responses[1] == std::vector<uint8_t>{1}, "Wrong responses");
+    check(client.getInFlightCount() == 0 && client.getPendingCount() == 0, "Requests left pending");
+
+    server.reset();
+
+    std::error_code timeoutError;
+    client.sendRequest({2}, [&timeoutError](const std::error_code& error, const std::vector<uint8_t>&) {
+        timeoutError = error;
+    }, 0.1f);
+
+    updateUntil(network, [&timeoutError]() { return static_cast<bool>(timeoutError); }, "Request without a server did not time out");
+    check(timeoutError == std::errc::timed_out, "Wrong error: " + timeoutError.message());
+
+    // the old connection has no server to answer the request, the new one has
+    server.reset(new cppsocket::MultiplexedServer(listener));
+    server->setRequestCallback([](cppsocket::Socket& s, uint32_t id, const std::vector<uint8_t>& request) {
+        cppsocket::MultiplexedServer::sendResponse(s, id, request);
+    });
+
+    std::error_code abortError;
+    client.sendRequest({3}, [&abortError](const std::error_code& error, const std::vector<uint8_t>&) {
+        abortError = error;
+    });
+
+    // the socket is reconnected without closing it first, so the close callback is not called
+    socket.connect(getLoopbackAddress(port));
+
+    bool reconnected = false;
+    client.sendRequest({4}, [&reconnected](const std::error_code& error, const std::vector<uint8_t>& response) {
+        check(!error, "Request made while connecting failed: " + error.message());
+        check(response == std::vector<uint8_t>{4}, "Wrong response");
+        reconnected = true;
+    });
+
+    updateUntil(network, [&reconnected]() { return reconnected; }, "Request made while connecting was not answered");
+    check(abortError == std::errc::connection_aborted, "Wrong error: " + abortError.message());
+    check(client.getInFlightCount() == 0 && client.getPendingCount() == 0, "Requests left pending");
+
+    bool rejected = false;
+    try
+    {
+        client.sendRequest(std::vector<uint8_t>(cppsocket::MAX_FRAME_SIZE + 1), nullptr);
+    }
+    catch (const std::runtime_error&)
+    {
+        rejected = true;
+    }
+
+    check(rejected && client.getPendingCount() == 0, "Request over the frame size limit was not rejected");
+}
+
+static std::unique_ptr<cppsocket::Compressor> createCompressor()
+{
+    return std::unique_ptr<cppsocket::Compressor>(new cppsocket::ZlibCompressor());
+}
+
+// sends a compressed message with a header that is not checked by the sending socket
+static void sendRawMessage(cppsocket::Socket& socket, uint32_t header, const std::vector<uint8_t>& message)
+{
+    std::vector<uint8_t> data = {
+        static_cast<uint8_t>(header >> 24), static_cast<uint8_t>(header >> 16),
+        static_cast<uint8_t>(header >> 8), static_cast<uint8_t>(header)
+    };
+    data.insert(data.end(), message.begin(), message.end());
+    socket.send(data);
+}
+
+// Compressed echo, a reconnect from the read callback with more messages buffered
+// and the messages over the limits
+static void checkCompression(uint16_t port)
+{
+    cppsocket::Network network;
+    cppsocket::Socket server(network);
+    std::error_code serverError;
+
+    server.setBlocking(false);
+    server.startAccept(cppsocket::ANY_ADDRESS, port);
+    server.setErrorCallback([&serverError](cppsocket::Socket&, const std::error_code& error) {
+        serverError = error;
+    });
+    server.setAcceptCallback([](cppsocket::Socket&, cppsocket::Socket& c) {
+        c.startRead();
+        c.setCompressor(createCompressor());
+        c.setReadCallback([](cppsocket::Socket& socket, const std::vector<uint8_t>& data) {
+            socket.send(data);
+        });
+
+        // read by the client in one go
+        for (uint8_t i = 0; i < 3; ++i)
+            c.send({'m', i});
+    });
+
+    std::vector<uint8_t> message;
+    for (size_t i = 0; i < 10000; ++i)
+        message.push_back(static_cast<uint8_t>('a' + i % 7));
+
+    cppsocket::Socket client(network);
+    std::vector<std::vector<uint8_t>> received;
+    bool reconnected = false;
+
+    client.setBlocking(false);
+    client.setCompressor(createCompressor());
+    client.setReadCallback([&received, &reconnected, port](cppsocket::Socket& socket, const std::vector<uint8_t>& data) {
+        // the messages after this one were read with it and are dropped with the old connection
+        if (!reconnected)
+        {
+            reconnected = true;
+            socket.connect(getLoopbackAddress(port));
+            return;
+        }
+
+        received.push_back(data);
+    });
+    client.setConnectCallback([&message, &reconnected](cppsocket::Socket& socket) {
+        if (reconnected)
+            socket.send(message);
+    });
+    client.connect(getLoopbackAddress(port));
+
+    updateUntil(network, [&received]() { return received.size() >= 4; }, "Compressed messages were not received");
+    check(received[0] == std::vector<uint8_t>{'m', 0} && received[3] == message, "Wrong compressed messages");
+    check(client.getCompressionStats().getSendRatio() > 10.0, "Message was not compressed");
+
+    for (int test = 0; test < 2; ++test)
+    {
+        cppsocket::Socket peer(network);
+        peer.setBlocking(false);
+        peer.connect(getLoopbackAddress(port));
+
+        if (test == 0)
+            // announces a message that is never sent
+            sendRawMessage(peer, 0x7FFFFFFF, {});
+        else
+        {
+            // a small message that inflates over the limit
+            std::vector<uint8_t> bomb;
+            cppsocket::ZlibCompressor compressor;
+            compressor.compress(std::vector<uint8_t>(cppsocket::MAX_DECOMPRESSED_MESSAGE_SIZE + 1).data(),
+                                cppsocket::MAX_DECOMPRESSED_MESSAGE_SIZE + 1, bomb);
+            sendRawMessage(peer, static_cast<uint32_t>(bomb.size()) | cppsocket::COMPRESSED_FLAG, bomb);
+        }
+
+        serverError = std::error_code();
+        updateUntil(network, [&serverError]() { return static_cast<bool>(serverError); }, "Message over the limit was accepted");
+        check(serverError == std::errc::bad_message, "Wrong error: " + serverError.message());
+    }
+}
+
+// Bulk transfer between two sockets with buffer tuning within a memory budget
+static void checkBufferTuning(uint16_t port)
+{
+#ifdef __linux__
+    const uint64_t budget = 1024 * 1024;
+    const size_t size = 32 * 1024 * 1024;
+
+    cppsocket::Network network;
+    network.setBufferTuningInterval(0.05f);
+    network.setBufferMemoryBudget(budget);
+
+    cppsocket::Socket server(network);
+    cppsocket::SocketHandle accepted;
+
+    server.setBlocking(false);
+    server.setBufferTuning(true);
+    server.startAccept(cppsocket::ANY_ADDRESS, port);
+    server.setAcceptCallback([&accepted](cppsocket::Socket&, cppsocket::Socket& c) {
+        accepted = c.getHandle();
+    });
+
+    cppsocket::Socket client(network);
+    size_t received = 0;
+
+    client.setBlocking(false);
+    client.setBufferTuning(true);
+    client.setReadCallback([&received](cppsocket::Socket&, const std::vector<uint8_t>& data) {
+        received += data.size();
+    });
+    client.connect(getLoopbackAddress(port));
+
+    const std::vector<uint8_t> chunk(256 * 1024, 't');
+    size_t sent = 0;
+
+    updateUntil(network, [&]() {
+        cppsocket::Socket* socket = network.getSocket(accepted);
+
+        // keeps a little data queued, so the kernel buffers limit the throughput
+        if (socket && sent < size && socket->getOutDataSize() < chunk.size())
+        {
+            socket->send(chunk);
+            sent += chunk.size();
+        }
+
+        return received >= size;
+    }, "Data with buffer tuning was not received", 30.0f);
+
+    cppsocket::Socket* socket = network.getSocket(accepted);
+    check(socket && socket->getSendBufferSize() > 0 && client.getReceiveBufferSize() > 0, "Buffers were not tuned");
+    check(network.getBufferMemory() > 0 && network.getBufferMemory() <= budget, "Buffers exceed the memory budget");
+#else
+    (void)port;
+#endif
+}
+
+// A receiver that is not updated while the sender fills its receive window, which is larger than the read
+// buffer of the network, gets a bigger receive buffer at the next tuning. The buffer is larger than
+// the four segments the tuning keeps at least, which are about 256 KiB on loopback
+static void checkReceiveWindow(uint16_t port)
+{
+#ifdef __linux__
+    const int receiveBufferSize = 1024 * 1024;
+
+    cppsocket::Network serverNetwork;
+    cppsocket::Socket server(serverNetwork);
+    cppsocket::SocketHandle accepted;
+
+    server.setBlocking(false);
+    server.startAccept(cppsocket::ANY_ADDRESS, port);
+    server.setAcceptCallback([&accepted](cppsocket::Socket&, cppsocket::Socket& c) {
+        accepted = c.getHandle();
+    });
+
+    cppsocket::Network clientNetwork;
+    clientNetwork.setBufferTuningInterval(0.5f);
+
+    cppsocket::Socket client(clientNetwork);
+    client.setBlocking(false);
+    client.setBufferTuning(true);
+    client.setReceiveBufferSize(receiveBufferSize);
+    client.connect(getLoopbackAddress(port));
+
+    updateUntil(serverNetwork, [&serverNetwork, &accepted, &clientNetwork, &client]() {
+        clientNetwork.update(0.0f);
+        return serverNetwork.getSocket(accepted) && client.isReady();
+    }, "Receiver was not connected");
+
+    serverNetwork.getSocket(accepted)->send(std::vector<uint8_t>(4 * receiveBufferSize, 'w'));
+
+    // only the sender is updated, so the receive window fills up
+    const auto endTime = std::chrono::steady_clock::now() + std::chrono::milliseconds(600);
+    while (std::chrono::steady_clock::now() < endTime)
+        serverNetwork.update(0.01f);
+
+    // the first update reads and tunes the buffers, as the tuning interval has passed,
+    // the tunings while connecting could have shrunk the buffer already
+    const int previousSize = client.getReceiveBufferSize();
+    clientNetwork.update(0.0f);
+    check(client.getReceiveBufferSize() > previousSize, "Full receive window was not detected");
+#else
+    (void)port;
+#endif
+}
+
+// A socket reconnected from its close callback after the server has closed the connection
+static void checkReconnectFromClose(uint16_t port)
+{
+    cppsocket::Network network;
+    cppsocket::Socket server(network);
+    size_t accepts = 0;
+
+    server.setBlocking(false);
+    server.startAccept(cppsocket::ANY_ADDRESS, port);
+    server.setAcceptCallback([&accepts](cppsocket::Socket&, cppsocket::Socket& c) {
+        // only the first connection is dropped
+        if (++accepts == 1)
+            c.close();
+        else
+            c.startRead();
+    });
+
+    cppsocket::Socket client(network);
+    size_t connects = 0;
+    uint32_t closedAddress = 0;
+
+    client.setBlocking(false);
+    client.setConnectCallback([&connects](cppsocket::Socket&) { ++connects; });
+    client.setCloseCallback([&closedAddress, port](cppsocket::Socket& socket) {
+        closedAddress = socket.getRemoteAddress();
+        socket.connect(getLoopbackAddress(port));
+    });
+    client.connect(getLoopbackAddress(port));
+
+    updateUntil(network, [&connects, &client]() { return connects >= 2 && client.isReady(); }, "Socket was not reconnected from the close callback");
+    check(closedAddress == htonl(INADDR_LOOPBACK), "Remote address was not available to the close callback");
+    check(accepts == 2, "Wrong number of connections");
+}
+
+// A relay that stops reading while the backend does not read and passes a half-close on
+// after all the buffered data, the other direction keeps working until the backend closes
+static void checkRelay(uint16_t port)
+{
+#ifdef __linux__
+    const int listenFd = createRawSocket();
+    const uint16_t backendPort = bindRawSocket(listenFd);
+    check(::listen(listenFd, 1) == 0, "Failed to start the backend");
+
+    cppsocket::Network network;
+    cppsocket::Socket server(network);
+    std::unique_ptr<cppsocket::Socket> backend;
+    size_t closed = 0;
+
+    server.setBlocking(false);
+    server.startAccept(cppsocket::ANY_ADDRESS, port);
+    server.setAcceptCallback([&network, &backend, &closed, backendPort](cppsocket::Socket&, cppsocket::Socket& c) {
+        backend.reset(new cppsocket::Socket(network));
+        backend->setBlocking(false);
+        backend->setCloseCallback([&closed](cppsocket::Socket&) { ++closed; });
+        c.setCloseCallback([&closed](cppsocket::Socket&) { ++closed; });
+        backend->connect(getLoopbackAddress(backendPort));
+        c.proxy(*backend);
+    });
+
+    const int clientFd = createRawSocket();
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    check(::connect(clientFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0 || errno == EINPROGRESS, "Failed to connect to the relay");
+
+    int backendFd = -1;
+    updateUntil(network, [listenFd, &backendFd]() {
+        backendFd = ::accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        return backendFd != -1;
+    }, "Relay did not connect to the backend");
+
+    // the backend does not read, so the client can send only as much as the buffers on the way hold
+    const std::vector<uint8_t> chunk(65536, 'r');
+    size_t sent = 0;
+    size_t stalledUpdates = 0;
+
+    updateUntil(network, [clientFd, &chunk, &sent, &stalledUpdates]() {
+        const ssize_t size = ::send(clientFd, chunk.data(), chunk.size(), MSG_NOSIGNAL);
+        if (size > 0)
+        {
+            sent += static_cast<size_t>(size);
+            stalledUpdates = 0;
+        }
+        else
+            ++stalledUpdates;
+
+        check(sent < 64 * 1024 * 1024, "Relay did not apply back-pressure");
+        return stalledUpdates >= 20;
+    }, "Relay did not apply back-pressure");
+
+    ::shutdown(clientFd, SHUT_WR);
+
+    size_t received = 0;
+    bool finished = false;
+    std::vector<uint8_t> buffer(65536);
+
+    updateUntil(network, [backendFd, &buffer, &received, &finished]() {
+        ssize_t size;
+        while ((size = ::recv(backendFd, buffer.data(), buffer.size(), 0)) > 0)
+            received += static_cast<size_t>(size);
+
+        finished = (size == 0);
+        check(size == 0 || errno == EAGAIN, "Failed to read from the relay");
+        return finished;
+    }, "Half-close was not passed on by the relay");
+
+    check(received == sent, "Data was lost by the relay");
+    check(closed == 0, "Relay was closed after the half-close");
+
+    // the backend answers after the client has shut down its side and closes the connection
+    check(::send(backendFd, "done", 4, MSG_NOSIGNAL) == 4, "Failed to send to the relay");
+    ::close(backendFd);
+
+    std::string response;
+    updateUntil(network, [clientFd, &buffer, &response]() {
+        ssize_t size;
+        while ((size = ::recv(clientFd, buffer.data(), buffer.size(), 0)) > 0)
+            response.append(buffer.begin(), buffer.begin() + size);
+
+        check(size == 0 || errno == EAGAIN, "Failed to read from the relay");
+        return size == 0;
+    }, "Response was not passed on by the relay");
+
+    check(response == "done", "Wrong response: " + response);
+    updateUntil(network, [&closed]() { return closed == 2; }, "Relay was not closed");
+
+    ::close(clientFd);
+    ::close(listenFd);
+#else
+    (void)port;
+#endif
+}
+
+// Echo through ring buffers smaller than the message, a refused connect, the data buffered before
+// the peer has closed and a relay that the memory transport does not support
+static void checkMemoryTransport(uint16_t port)
+{
+    cppsocket::MemoryTransport transport(1024);
+    cppsocket::Network network(transport);
+    cppsocket::Socket server(network);
+    cppsocket::SocketHandle accepted;
+
+    server.setBlocking(false);
+    server.startAccept(cppsocket::ANY_ADDRESS, port);
+    server.setAcceptCallback([&accepted](cppsocket::Socket&, cppsocket::Socket& c) {
+        accepted = c.getHandle();
+        c.startRead();
+        c.setReadCallback([](cppsocket::Socket& socket, const std::vector<uint8_t>& data) {
+            socket.send(data);
+        });
+    });
+
+    std::vector<uint8_t> message;
+    for (size_t i = 0; i < 100000; ++i)
+        message.push_back(static_cast<uint8_t>(i % 251));
+
+    cppsocket::Socket client(network);
+    std::vector<uint8_t> received;
+    bool closed = false;
+
+    client.setBlocking(false);
+    client.setReadCallback([&received](cppsocket::Socket&, const std::vector<uint8_t>& data) {
+        received.insert(received.end(), data.begin(), data.end());
+    });
+    client.setCloseCallback([&closed](cppsocket::Socket&) { closed = true; });
+    client.connect(getLoopbackAddress(port));
+    client.send(message);
+
+    updateUntil(network, [&received, &message]() { return received.size() >= message.size(); }, "Echo over the memory transport was not received");
+    check(received == message, "Wrong echo over the memory transport");
+    check(client.getRemotePort() == port && client.getLocalPort() != 0, "Wrong addresses of the memory socket");
+
+    bool relayRejected = false;
+    try
+    {
+        if (cppsocket::Socket* socket = network.getSocket(accepted))
+            socket->relayTo(client);
+    }
+    catch (const std::runtime_error&)
+    {
+        relayRejected = true;
+    }
+
+    check(relayRejected, "Relay over the memory transport was not rejected");
+
+    // the data sent before the close is read before the close callback
+    received.clear();
+    cppsocket::Socket* socket = network.getSocket(accepted);
+    check(socket != nullptr, "Accepted memory socket was not found");
+    socket->send({'b', 'y', 'e'});
+    socket->close();
+
+    updateUntil(network, [&closed]() { return closed; }, "Close over the memory transport was not reported");
+    check(received == std::vector<uint8_t>{'b', 'y', 'e'}, "Data sent before the close was lost");
+
+    cppsocket::Socket refused(network);
+    bool failed = false;
+
+    refused.setBlocking(false);
+    refused.setConnectErrorCallback([&failed](cppsocket::Socket&) { failed = true; });
+    refused.connect(getLoopbackAddress(static_cast<uint16_t>(port + 1)));
+
+    updateUntil(network, [&failed]() { return failed; }, "Refused memory connect was not reported");
+    check(!refused.isReady(), "Refused memory socket is ready");
+}
+
+// The write budget goes to the sockets with a higher priority first, the sockets with the same
+// priority take turns and none of them writes more than the quantum in one update
+static void checkWriteScheduler(uint16_t port)
+{
+    const size_t quantum = 1000;
+
+    cppsocket::MemoryTransport transport;
+    cppsocket::Network network(transport);
+    cppsocket::Socket server(network);
+
+    server.setBlocking(false);
+    server.startAccept(cppsocket::ANY_ADDRESS, port);
+    server.setAcceptCallback([](cppsocket::Socket&, cppsocket::Socket& c) {
+        c.startRead();
+    });
+
+    std::vector<std::unique_ptr<cppsocket::Socket>> clients;
+
+    for (int i = 0; i < 3; ++i)
+    {
+        clients.push_back(std::unique_ptr<cppsocket::Socket>(new cppsocket::Socket(network)));
+        clients.back()->setBlocking(false);
+        clients.back()->connect(getLoopbackAddress(port));
+    }
+
+    updateUntil(network, [&clients]() {
+        return std::all_of(clients.begin(), clients.end(), [](const std::unique_ptr<cppsocket::Socket>& client) {
+            return client->isReady();
+        });
+    }, "Memory sockets were not connected");
+
+    network.setWriteQuantum(quantum);
+    network.setWriteBudget(quantum);
+    clients[2]->setWritePriority(1);
+
+    for (const std::unique_ptr<cppsocket::Socket>& client : clients)
+        client->send(std::vector<uint8_t>(3 * quantum, 'w'));
+
+    std::vector<size_t> previous(clients.size(), 0);
+    size_t updates = 0;
+
+    while (std::any_of(clients.begin(), clients.end(), [](const std::unique_ptr<cppsocket::Socket>& client) {
+        return client->hasOutData();
+    }))
+    {
+        check(++updates < 20, "Data was not written");
+        network.update(0.0f);
+
+        std::vector<size_t> written;
+        for (const std::unique_ptr<cppsocket::Socket>& client : clients)
+            written.push_back(3 * quantum - client->getOutDataSize());
+
+        // one socket writes the whole budget in every update
+        size_t writers = 0;
+        for (size_t i = 0; i < clients.size(); ++i)
+        {
+            check(written[i] - previous[i] == 0 || written[i] - previous[i] == quantum, "Quantum exceeded");
+            if (written[i] != previous[i]) ++writers;
+        }
+
+        check(writers == 1, "Budget exceeded or not used");
+
+        if (updates <= 3)
+            check(written[2] == updates * quantum, "Socket with the higher priority was not written first");
+        else
+        {
+            const size_t difference = (written[0] > written[1]) ? written[0] - written[1] : written[1] - written[0];
+            check(difference <= quantum, "Sockets with the same priority did not take turns");
+        }
+
+        previous = written;
+    }
+
+    check(updates == 9, "Wrong number of updates");
+}
+
+// Ping-pong between timestamping sockets, the receive time of every read and the delays of every
+// send and receive are recorded, the accepted socket inherits the timestamping of the listening one
+static void checkTimestamping(uint16_t port)
+{
+#ifdef __linux__
+    const size_t rounds = 10;
+    const uint64_t maxDelay = 5000000000ULL;
+
+    cppsocket::Network network;
+    cppsocket::Socket server(network);
+    cppsocket::SocketHandle accepted;
+    bool serverStamped = false;
+    bool receiveTimes = true;
+
+    // returns whether the last read was timestamped
+    const auto checkReceiveTime = [&receiveTimes](const cppsocket::Socket& socket) {
+        const auto now = std::chrono::system_clock::now();
+        if (socket.getReceiveTime() > now || now - socket.getReceiveTime() > std::chrono::seconds(5))
+            receiveTimes = false;
+
+        return socket.getReceiveTime() != std::chrono::system_clock::time_point();
+    };
+
+    server.setBlocking(false);
+    server.setTimestamping(true);
+    server.startAccept(cppsocket::ANY_ADDRESS, port);
+    server.setAcceptCallback([&](cppsocket::Socket&, cppsocket::Socket& c) {
+        accepted = c.getHandle();
+        c.startRead();
+        c.setReadCallback([&](cppsocket::Socket& socket, const std::vector<uint8_t>& data) {
+            serverStamped = checkReceiveTime(socket);
+            socket.send(data);
+        });
+    });
+
+    cppsocket::Socket client(network);
+    size_t received = 0;
+    size_t target = 0;
+    bool clientStamped = false;
+
+    client.setBlocking(false);
+    client.setTimestamping(true);
+    client.setReadCallback([&](cppsocket::Socket& socket, const std::vector<uint8_t>& data) {
+        clientStamped = checkReceiveTime(socket);
+        received += data.size();
+        if (received < target)
+            socket.send({'t'});
+    });
+    client.connect(getLoopbackAddress(port));
+
+    // the data that arrives before the accepted socket has the option is not timestamped
+    updateUntil(network, [&network, &accepted, &client]() {
+        return network.getSocket(accepted) && client.isReady();
+    }, "Timestamping socket was not connected");
+
+    cppsocket::Socket* socket = network.getSocket(accepted);
+    check(socket->isTimestamping(), "Accepted socket does not inherit the timestamping");
+
+    // the kernel starts timestamping the received packets a moment after the first socket asks for it
+    updateUntil(network, [&]() {
+        if (received == target)
+        {
+            if (serverStamped && clientStamped)
+                return true;
+
+            ++target;
+            client.send({'t'});
+        }
+
+        return false;
+    }, "Received data was not timestamped");
+
+    client.resetLatencyStats();
+    socket->resetLatencyStats();
+    receiveTimes = true;
+    target = received + rounds;
+    client.send({'t'});
+
+    // every read is timestamped now
+    updateUntil(network, [&received, &target]() { return received >= target; }, "Timestamped data was not received");
+    check(receiveTimes, "Wrong receive time");
+
+    for (const cppsocket::LatencyStats* stats : {client.getLatencyStats(), socket->getLatencyStats()})
+    {
+        // the transmit timestamps are read from the error queue after the writes
+        updateUntil(network, [stats, rounds]() { return stats->sendKernelDelay.getCount() >= rounds; }, "Transmit timestamps were not recorded");
+
+        check(stats->receiveWaitDelay.getCount() >= rounds && stats->receiveDispatchDelay.getCount() >= rounds, "Receive delays were not recorded");
+        check(stats->sendQueueDelay.getCount() >= rounds, "Send delays were not recorded");
+        check(stats->receiveWaitDelay.getMax() < maxDelay && stats->receiveDispatchDelay.getMax() < maxDelay &&
+              stats->sendQueueDelay.getMax() < maxDelay && stats->sendKernelDelay.getMax() < maxDelay, "Wrong delays");
+    }
+#else
+    (void)port;
+#endif
+}
+
+// Messages published between the data sent on a subscriber keep their order, the messages over the
+// queue limit of the hub are dropped, conflated or disconnect the subscriber depending on the policy
+static void checkBroadcast(uint16_t port)
+{
+    const size_t subscriberCount = 2;
+    const size_t size = 3000;
+
+    for (cppsocket::SlowConsumerPolicy policy : {cppsocket::SlowConsumerPolicy::Drop,
+                                                 cppsocket::SlowConsumerPolicy::Conflate,
+                                                 cppsocket::SlowConsumerPolicy::Disconnect})
+    {
+        cppsocket::MemoryTransport transport;
+        cppsocket::Network network(transport);
+        cppsocket::BroadcastHub hub(network, policy, 4096);
+        cppsocket::Socket server(network);
+        std::vector<cppsocket::SocketHandle> accepted;
+
+        server.setBlocking(false);
+        server.startAccept(cppsocket::ANY_ADDRESS, port);
+        server.setAcceptCallback([&hub, &accepted](cppsocket::Socket&, cppsocket::Socket& c) {
+            accepted.push_back(c.getHandle());
+            hub.subscribe("topic", c);
+        });
+
+        std::vector<std::unique_ptr<cppsocket::Socket>> clients;
+        std::vector<std::string> received(subscriberCount);
+        size_t closed = 0;
+
+        for (size_t i = 0; i < subscriberCount; ++i)
+        {
+            clients.push_back(std::unique_ptr<cppsocket::Socket>(new cppsocket::Socket(network)));
+            clients.back()->setBlocking(false);
+            clients.back()->setReadCallback([&received, i](cppsocket::Socket&, const std::vector<uint8_t>& data) {
+                received[i].append(data.begin(), data.end());
+            });
+            clients.back()->setCloseCallback([&closed](cppsocket::Socket&) { ++closed; });
+            clients.back()->connect(getLoopbackAddress(port));
+        }
+
+        updateUntil(network, [&accepted, subscriberCount]() { return accepted.size() >= subscriberCount; }, "Subscribers were not accepted");
+        check(hub.getSubscriberCount("topic") == subscriberCount, "Wrong number of subscribers");
+
+        cppsocket::Socket* first = network.getSocket(accepted[0]);
+        first->send({'a'});
+        hub.publish("topic", {'B'});
+        first->send({'c', 'd'});
+        hub.publish("topic", {'E'});
+        hub.publish("topic", {'F'});
+        first->send({'g'});
+
+        updateUntil(network, [&received]() { return received[0].size() >= 7 && received[1].size() >= 3; }, "Published messages were not received");
+        check(received[0] == "aBcdEFg" && received[1] == "BEF", "Wrong order of the published messages");
+
+        // nothing is written between the publishes, so only the first message fits in the queue
+        hub.resetStats();
+        for (char c : {'x', 'y', 'z'})
+            hub.publish("topic", std::vector<uint8_t>(size, static_cast<uint8_t>(c)));
+
+        const cppsocket::BroadcastStats& stats = hub.getStats();
+
+        for (std::string& data : received)
+            data.clear();
+
+        if (policy == cppsocket::SlowConsumerPolicy::Disconnect)
+        {
+            // the topic is removed with its last subscriber, so the last message is not published
+            check(stats.messagesPublished == 2 && stats.messagesQueued == subscriberCount &&
+                  stats.subscribersDisconnected == subscriberCount &&
+                  stats.messagesDropped == 0 && stats.messagesConflated == 0, "Wrong stats of the disconnect policy");
+            check(hub.getSubscriberCount("topic") == 0, "Slow subscribers were not removed");
+
+            updateUntil(network, [&closed, subscriberCount]() { return closed >= subscriberCount; }, "Slow subscribers were not disconnected");
+            check(received[0].empty() && received[1].empty(), "Data of the disconnected subscribers was sent");
+            continue;
+        }
+
+        // the conflated messages replace the first one, the dropped ones are never sent
+        const std::string expected = (policy == cppsocket::SlowConsumerPolicy::Drop) ? std::string(size, 'x') : std::string(size, 'z');
+
+        check(stats.messagesPublished == 3, "Wrong number of published messages");
+
+        if (policy == cppsocket::SlowConsumerPolicy::Drop)
+            check(stats.messagesQueued == subscriberCount && stats.messagesDropped == 2 * subscriberCount &&
+                  stats.messagesConflated == 0, "Wrong stats of the drop policy");
+        else
+            check(stats.messagesQueued == subscriberCount && stats.messagesConflated == 2 * subscriberCount &&
+                  stats.messagesDropped == 0, "Wrong stats of the conflate policy");
+
+        updateUntil(network, [&received]() { return received[0].size() >= size && received[1].size() >= size; }, "Messages under the limit were not received");
+
+        // more data would arrive with the following updates
+        for (int i = 0; i < 5; ++i)
+            network.update(0.0f);
+
+        check(received[0] == expected && received[1] == expected && closed == 0, "Wrong messages over the queue limit");
+    }
+}
+
+// Non-blocking connects that are refused or time out and connections reset by the peer give their
+// error to the error callback, the connect error callback is called before it
+static void checkErrorCallback(uint16_t port)
+{
+#ifdef __linux__
+    cppsocket::Network network;
+    std::vector<std::string> events;
+    std::error_code error;
+
+    const auto setCallbacks = [&events, &error](cppsocket::Socket& socket) {
+        socket.setBlocking(false);
+        socket.setConnectCallback([&events](cppsocket::Socket&) { events.push_back("connect"); });
+        socket.setConnectErrorCallback([&events](cppsocket::Socket&) { events.push_back("connect error"); });
+        socket.setErrorCallback([&events, &error](cppsocket::Socket&, const std::error_code& e) {
+            events.push_back("error");
+            error = e;
+        });
+    };
+
+    // ports without a listener refuse the connection
+    const int closedFd = createRawSocket();
+    const uint16_t closedPort = bindRawSocket(closedFd);
+    const int otherClosedFd = createRawSocket();
+    const uint16_t otherClosedPort = bindRawSocket(otherClosedFd);
+
+    for (size_t count : {1, 2})
+    {
+        cppsocket::Socket client(network);
+        setCallbacks(client);
+
+        events.clear();
+        error.clear();
+
+        if (count == 1)
+            client.connect(getLoopbackAddress(closedPort));
+        else
+            client.connect({{htonl(INADDR_LOOPBACK), closedPort}, {htonl(INADDR_LOOPBACK), otherClosedPort}});
+
+        updateUntil(network, [&events]() { return events.size() >= 2; }, "Refused connection was not reported");
+
+        // more callbacks would be called with the following updates
+        for (int i = 0; i < 5; ++i)
+            network.update(0.0f);
+
+        check(events == std::vector<std::string>{"connect error", "error"}, "Wrong callbacks of the refused connection");
+        check(error == std::errc::connection_refused, "Wrong error: " + error.message());
+    }
+
+    ::close(otherClosedFd);
+    ::close(closedFd);
+
+    // a listener that does not answer makes the connect time out
+    int silentFd;
+    int fillerFd;
+    const uint16_t silentPort = startSilentListener(silentFd, fillerFd);
+
+    {
+        cppsocket::Socket client(network);
+        setCallbacks(client);
+        client.setConnectTimeout(0.2f);
+
+        events.clear();
+        error.clear();
+        client.connect(getLoopbackAddress(silentPort));
+
+        updateUntil(network, [&events]() { return events.size() >= 2; }, "Connect timeout was not reported");
+        check(events == std::vector<std::string>{"connect error", "error"}, "Wrong callbacks of the connect timeout");
+        check(error == std::errc::timed_out, "Wrong error: " + error.message());
+    }
+
+    ::close(fillerFd);
+    ::close(silentFd);
+
+    // closing with a zero linger time resets the connection
+    cppsocket::Socket server(network);
+    bool accepted = false;
+
+    setCallbacks(server);
+    server.startAccept(cppsocket::ANY_ADDRESS, port);
+    server.setAcceptCallback([&accepted](cppsocket::Socket&, cppsocket::Socket& c) {
+        accepted = true;
+        c.startRead();
+    });
+
+    const int clientFd = createRawSocket();
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    check(::connect(clientFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0 || errno == EINPROGRESS, "Failed to connect");
+
+    events.clear();
+    error.clear();
+    updateUntil(network, [&accepted]() { return accepted; }, "Connection was not accepted");
+
+    const linger reset = {1, 0};
+    check(::setsockopt(clientFd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset)) == 0, "Failed to set linger");
+    ::close(clientFd);
+
+    updateUntil(network, [&events]() { return !events.empty(); }, "Reset was not reported");
+    check(events == std::vector<std::string>{"error"}, "Wrong callbacks of the reset connection");
+    check(error == std::errc::connection_reset, "Wrong error: " + error.message());
+#else
+    (void)port;
+#endif
+}
+
+int main(int argc, const char* argv[])
+{
+    try
+    {
+        const std::vector<std::pair<std::string, std::function<void(uint16_t)>>> checks = {
+            {"send-from-any-thread", checkSendFromAnyThread},
+            {"busy-poll", checkBusyPoll},
+            {"pacing", checkPacing},
+            {"cancelled-timers", checkCancelledTimers},
+            {"send-while-connecting", checkSendWhileConnecting},
+            {"connect-attempts", checkConnectAttempts},
+            {"fast-open", checkFastOpen},
+            {"multiplexer", checkMultiplexer},
+            {"compression", checkCompression},
+            {"buffer-tuning", checkBufferTuning},
+            {"receive-window", checkReceiveWindow},
+            {"reconnect-from-close", checkReconnectFromClose},
+            {"relay", checkRelay},
+            {"memory-transport", checkMemoryTransport},
+            {"write-scheduler", checkWriteScheduler},
+            {"timestamping", checkTimestamping},
+            {"broadcast", checkBroadcast},
+            {"error-callback", checkErrorCallback}
+        };
+
+        uint16_t port = 9100;
+        std::vector<std::string> selected;
+
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string argument = argv[i];
+
+            if (argument == "--port")
+            {
+                if (++i >= argc)
+                {
+                    printUsage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+
+                port = static_cast<uint16_t>(std::stoul(argv[i]));
+            }
+            else
+                selected.push_back(argument);
+        }
+
+        for (const auto& entry : checks)
+        {
+            if (!selected.empty() && std::find(selected.begin(), selected.end(), entry.first) == selected.end())
+                continue;
+
+            // every check listens on its own port, so the sockets left in TIME_WAIT do not matter
+            entry.second(port++);
+            std::cout << entry.first << ": OK" << std::endl;
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    catch (...)
+    {
+        std::cerr << "Error" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
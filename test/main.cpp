@@ -10,7 +10,7 @@
 
 static void printUsage(const std::string& executable)
 {
-    std::cout << "Usage: " << executable << " [server|client] [port|address]" << std::endl;
+    std::cout << "Usage: " << executable << " [server|client] [port|address[,address...]]" << std::endl;
 }
 
 int main(int argc, const char* argv[])
@@ -29,7 +29,6 @@ int main(int argc, const char* argv[])
         cppsocket::Network network;
         cppsocket::Socket server(network);
         cppsocket::Socket client(network);
-        std::vector<cppsocket::Socket> clientSockets;
 
         if (type == "server")
         {
@@ -40,33 +39,30 @@ int main(int argc, const char* argv[])
             server.setBlocking(false);
             server.startAccept(cppsocket::ANY_ADDRESS, port);
 
-            server.setAcceptCallback([&clientSockets](cppsocket::Socket&, cppsocket::Socket& c) {
+            // accepted sockets are owned by the network and destroyed after they get closed
+            server.setAcceptCallback([](cppsocket::Socket&, cppsocket::Socket& c) {
                 std::cout << "Client connected" << std::endl;
                 c.startRead();
                 c.send({'t', 'e', 's', 't', '\0'});
-                c.setCloseCallback([&clientSockets](cppsocket::Socket& socket) {
+                c.setCloseCallback([](cppsocket::Socket& socket) {
                     std::cout << "Client at " << cppsocket::ipToString(socket.getRemoteAddress()) << " disconnected" << std::endl;
-
-                    for (auto i = clientSockets.begin(); i != clientSockets.end();)
-                    {
-                        if (&(*i) == &socket)
-                        {
-                            clientSockets.erase(i);
-                            break;
-                        }
-                        else
-                            ++i;
-                    }
-
                 });
-                clientSockets.push_back(std::move(c));
             });
         }
         else if (type == "client")
         {
+            // multiple addresses are connected to in parallel
+            std::vector<std::pair<uint32_t, uint16_t>> addresses;
+            std::istringstream buffer(address);
+            std::string addressStr;
+
+            while (std::getline(buffer, addressStr, ','))
+                for (const std::pair<uint32_t, uint16_t>& addr : cppsocket::getAddresses(addressStr))
+                    addresses.push_back(addr);
+
             client.setBlocking(false);
             client.setConnectTimeout(2.0f);
-            client.connect(address);
+            client.connect(addresses);
 
             client.setReadCallback([](cppsocket::Socket& socket, const std::vector<uint8_t>& data) {
                 std::cout << "Got data: " << data.data() << " from " << cppsocket::ipToString(socket.getRemoteAddress()) << std::endl;
@@ -78,10 +74,10 @@ int main(int argc, const char* argv[])
                 socket.send({'t', 'e', 's', 't', '\0'});
             });
 
-            client.setConnectErrorCallback([&client, address](cppsocket::Socket& socket) {
+            client.setConnectErrorCallback([&client, addresses](cppsocket::Socket& socket) {
                 std::cout << "Failed to connected to " << cppsocket::ipToString(socket.getRemoteAddress()) << std::endl;
 
-                client.connect(address);
+                client.connect(addresses);
             });
         }
 